@@ -0,0 +1,400 @@
+static const uint32_t a64_scratch0 = 16;
+static const uint32_t a64_scratch1 = 17;
+static const uint32_t a64_fp = 29;
+static const uint32_t a64_sp = 31;
+
+static char *const a64_reg_names[32] = {
+        "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
+        "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29",
+        "x30", "sp",
+};
+
+struct a64_opcode {
+	char *mnemonic;
+	uint32_t bits;
+};
+
+static const struct a64_opcode a64_add = {"add", 0x8b000000};
+static const struct a64_opcode a64_sub = {"sub", 0xcb000000};
+static const struct a64_opcode a64_mul = {"mul", 0x9b007c00};
+static const struct a64_opcode a64_sdiv = {"sdiv", 0x9ac00c00};
+static const struct a64_opcode a64_add_imm = {"add", 0x91000000};
+static const struct a64_opcode a64_sub_imm = {"sub", 0xd1000000};
+static const struct a64_opcode a64_movz = {"movz", 0xd2800000};
+static const struct a64_opcode a64_movn = {"movn", 0x92800000};
+static const struct a64_opcode a64_movk = {"movk", 0xf2800000};
+static const struct a64_opcode a64_ldr = {"ldr", 0xf9400000};
+static const struct a64_opcode a64_str = {"str", 0xf9000000};
+
+static void a64_encode(struct codegen *cg, uint32_t bits) {
+	object_u32(cg->object, bits);
+}
+
+static void a64_reg(struct codegen *cg, uint32_t reg) {
+	emit_str(cg->out, a64_reg_names[reg]);
+}
+
+static void a64_op(struct codegen *cg, char *mnemonic) {
+	emit_char(cg->out, '\t');
+	emit_str(cg->out, mnemonic);
+	emit_char(cg->out, ' ');
+}
+
+static void a64_end(struct codegen *cg) {
+	emit_char(cg->out, '\n');
+}
+
+static void a64_fixed(struct codegen *cg, char *text, uint32_t bits) {
+	if (cg->object) {
+		a64_encode(cg, bits);
+	} else {
+		emit_str(cg->out, text);
+	}
+}
+
+static void a64_mov(struct codegen *cg, uint32_t rd, uint32_t rm) {
+	if (cg->object) {
+		a64_encode(cg, 0xaa0003e0 | rm << 16 | rd);
+		return;
+	}
+	a64_op(cg, "mov");
+	a64_reg(cg, rd);
+	emit_literal(cg->out, ", ");
+	a64_reg(cg, rm);
+	a64_end(cg);
+}
+
+static void a64_rrr(struct codegen *cg, struct a64_opcode op, uint32_t rd, uint32_t rn, uint32_t rm) {
+	if (cg->object) {
+		// Register 31 means xzr in the shifted-register form, so sp needs the extended-register form.
+		uint32_t bits = op.bits;
+		if (rd == a64_sp || rn == a64_sp) bits |= 0x00206000;
+		a64_encode(cg, bits | rm << 16 | rn << 5 | rd);
+		return;
+	}
+	a64_op(cg, op.mnemonic);
+	a64_reg(cg, rd);
+	emit_literal(cg->out, ", ");
+	a64_reg(cg, rn);
+	emit_literal(cg->out, ", ");
+	a64_reg(cg, rm);
+	a64_end(cg);
+}
+
+static void a64_rri(struct codegen *cg, struct a64_opcode op, uint32_t rd, uint32_t rn, uint64_t imm) {
+	assert(imm <= 0xfff);
+	if (cg->object) {
+		a64_encode(cg, op.bits | (uint32_t)imm << 10 | rn << 5 | rd);
+		return;
+	}
+	a64_op(cg, op.mnemonic);
+	a64_reg(cg, rd);
+	emit_literal(cg->out, ", ");
+	a64_reg(cg, rn);
+	emit_literal(cg->out, ", #");
+	emit_u64(cg->out, imm);
+	a64_end(cg);
+}
+
+static void a64_move_wide(struct codegen *cg, struct a64_opcode op, uint32_t rd, uint64_t imm, size_t shift) {
+	assert(imm <= 0xffff);
+	if (cg->object) {
+		a64_encode(cg, op.bits | (uint32_t)(shift / 16) << 21 | (uint32_t)imm << 5 | rd);
+		return;
+	}
+	a64_op(cg, op.mnemonic);
+	a64_reg(cg, rd);
+	emit_literal(cg->out, ", #");
+	emit_u64(cg->out, imm);
+	emit_literal(cg->out, ", lsl #");
+	emit_u64(cg->out, shift);
+	a64_end(cg);
+}
+
+// Offsets that are small multiples of 8 use the scaled unsigned form (ldr/str),
+// the others the unscaled signed form (ldur/stur), which the assembler picks for us.
+static void a64_memory(struct codegen *cg, struct a64_opcode op, uint32_t rt, uint32_t rn, int64_t offset) {
+	if (cg->object) {
+		if (offset >= 0 && offset % 8 == 0 && offset <= 32760) {
+			a64_encode(cg, op.bits | (uint32_t)(offset / 8) << 10 | rn << 5 | rt);
+		} else {
+			assert(offset >= -256 && offset <= 255);
+			uint32_t unscaled = op.bits & ~0x01000000u;
+			a64_encode(cg, unscaled | ((uint32_t)offset & 0x1ff) << 12 | rn << 5 | rt);
+		}
+		return;
+	}
+	a64_op(cg, op.mnemonic);
+	a64_reg(cg, rt);
+	emit_literal(cg->out, ", [");
+	a64_reg(cg, rn);
+	if (offset) {
+		emit_literal(cg->out, ", #");
+		emit_i64(cg->out, offset);
+	}
+	emit_literal(cg->out, "]\n");
+}
+
+static void a64_branch_to_return(struct codegen *cg) {
+	if (cg->object) {
+		struct branch_fixup *fixup = arena_push_struct(&scratch_arena, struct branch_fixup);
+		fixup->offset = cg->object->text_size;
+		fixup->next = cg->return_branches;
+		cg->return_branches = fixup;
+		a64_encode(cg, 0x14000000);
+		return;
+	}
+	a64_op(cg, "b");
+	codegen_return_label(cg);
+	a64_end(cg);
+}
+
+static void a64_place_return_label(struct codegen *cg) {
+	if (cg->object) {
+		for (struct branch_fixup *fixup = cg->return_branches; fixup; fixup = fixup->next) {
+			uint32_t delta = (uint32_t)((cg->object->text_size - fixup->offset) / 4);
+			uint32_t bits = object_read_u32(cg->object, fixup->offset);
+			object_write_u32(cg->object, fixup->offset, bits | (delta & 0x3ffffff));
+		}
+		cg->return_branches = 0;
+		return;
+	}
+	codegen_return_label(cg);
+	emit_literal(cg->out, ":\n");
+}
+
+static void a64_mov_imm(struct codegen *cg, uint32_t dst, uint64_t value) {
+	if (value <= 0xffff) {
+		if (cg->object) {
+			a64_move_wide(cg, a64_movz, dst, value, 0);
+		} else {
+			a64_op(cg, "mov");
+			a64_reg(cg, dst);
+			emit_literal(cg->out, ", #");
+			emit_u64(cg->out, value);
+			a64_end(cg);
+		}
+		return;
+	}
+
+	size_t zero_chunks = 0;
+	size_t ones_chunks = 0;
+	for (size_t shift = 0; shift < 64; shift += 16) {
+		uint64_t chunk = (value >> shift) & 0xffff;
+		zero_chunks += chunk == 0;
+		ones_chunks += chunk == 0xffff;
+	}
+
+	bool inverted = ones_chunks > zero_chunks;
+	uint64_t skip = inverted ? 0xffff : 0;
+	bool first = true;
+	for (size_t shift = 0; shift < 64; shift += 16) {
+		uint64_t chunk = (value >> shift) & 0xffff;
+		if (chunk == skip && !(first && shift == 48)) continue;
+		if (first) {
+			uint64_t initial = inverted ? ~chunk & 0xffff : chunk;
+			a64_move_wide(cg, inverted ? a64_movn : a64_movz, dst, initial, shift);
+			first = false;
+		} else {
+			a64_move_wide(cg, a64_movk, dst, chunk, shift);
+		}
+	}
+}
+
+// Computes base + offset into dst for offsets that don’t fit an add/sub immediate.
+static void a64_add_offset(struct codegen *cg, uint32_t dst, uint32_t base, int64_t offset) {
+	uint64_t magnitude = offset < 0 ? -(uint64_t)offset : (uint64_t)offset;
+	if (magnitude <= 0xfff) {
+		a64_rri(cg, offset < 0 ? a64_sub_imm : a64_add_imm, dst, base, magnitude);
+	} else {
+		uint32_t imm_reg = dst == base ? a64_scratch0 : dst;
+		a64_mov_imm(cg, imm_reg, magnitude);
+		a64_rrr(cg, offset < 0 ? a64_sub : a64_add, dst, base, imm_reg);
+	}
+}
+
+static void a64_load_store(struct codegen *cg, struct a64_opcode op, uint32_t reg, uint32_t base, int64_t offset,
+        uint32_t scratch) {
+	bool scaled = offset >= 0 && offset % 8 == 0 && offset <= 32760;
+	bool unscaled = offset >= -256 && offset <= 255;
+	if (scaled || unscaled) {
+		a64_memory(cg, op, reg, base, offset);
+	} else {
+		assert(scratch != base);
+		a64_add_offset(cg, scratch, base, offset);
+		a64_memory(cg, op, reg, scratch, 0);
+	}
+}
+
+static void a64_frame_store(struct codegen *cg, uint32_t reg, size_t offset) {
+	uint32_t scratch = reg == a64_scratch1 ? a64_scratch0 : a64_scratch1;
+	a64_load_store(cg, a64_str, reg, a64_fp, -(int64_t)offset, scratch);
+}
+
+static uint32_t a64_use(struct codegen *cg, uint32_t reg, uint32_t scratch) {
+	if (reg < reg_virtual_first) return reg;
+	struct interval *interval = interval_of(cg, reg);
+	if (interval->reg != reg_none) return interval->reg;
+	a64_load_store(cg, a64_ldr, scratch, a64_fp, -(int64_t)interval->spill_offset, scratch);
+	return scratch;
+}
+
+static uint32_t a64_def(struct codegen *cg, uint32_t reg) {
+	if (reg < reg_virtual_first) return reg;
+	struct interval *interval = interval_of(cg, reg);
+	if (interval->reg != reg_none) return interval->reg;
+	return a64_scratch0;
+}
+
+static void a64_def_done(struct codegen *cg, uint32_t reg) {
+	if (reg < reg_virtual_first) return;
+	struct interval *interval = interval_of(cg, reg);
+	if (interval->reg == reg_none) a64_frame_store(cg, a64_scratch0, interval->spill_offset);
+}
+
+static void a64_inst(struct codegen *cg, struct inst *inst) {
+	switch (inst->kind) {
+	case inst_kind_mov: {
+		uint32_t src = a64_use(cg, inst->src1, a64_scratch0);
+		uint32_t dst = a64_def(cg, inst->dst);
+		if (dst != src) a64_mov(cg, dst, src);
+		a64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_mov_imm:
+		a64_mov_imm(cg, a64_def(cg, inst->dst), (uint64_t)inst->imm);
+		a64_def_done(cg, inst->dst);
+		break;
+
+	case inst_kind_add:
+	case inst_kind_sub:
+	case inst_kind_mul:
+	case inst_kind_sdiv: {
+		static const struct a64_opcode *const opcodes[] = {
+		        [inst_kind_add] = &a64_add,
+		        [inst_kind_sub] = &a64_sub,
+		        [inst_kind_mul] = &a64_mul,
+		        [inst_kind_sdiv] = &a64_sdiv,
+		};
+		uint32_t lhs = a64_use(cg, inst->src1, a64_scratch0);
+		uint32_t rhs = a64_use(cg, inst->src2, a64_scratch1);
+		uint32_t dst = a64_def(cg, inst->dst);
+		a64_rrr(cg, *opcodes[inst->kind], dst, lhs, rhs);
+		a64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_frame_address: {
+		uint32_t dst = a64_def(cg, inst->dst);
+		a64_add_offset(cg, dst, a64_fp, -inst->imm);
+		a64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_symbol_address: {
+		uint32_t dst = a64_def(cg, inst->dst);
+		if (cg->object) {
+			codegen_relocate(cg, inst->entity, elf_reloc_aarch64_adr_prel_pg_hi21, 0);
+			a64_encode(cg, 0x90000000 | dst);
+			codegen_relocate(cg, inst->entity, elf_reloc_aarch64_add_abs_lo12_nc, 0);
+			a64_rri(cg, a64_add_imm, dst, dst, 0);
+		} else {
+			bool elf = cg->target->elf;
+			a64_op(cg, "adrp");
+			a64_reg(cg, dst);
+			emit_literal(cg->out, ", ");
+			codegen_symbol(cg, inst->entity);
+			if (!elf) emit_literal(cg->out, "@PAGE");
+			a64_end(cg);
+			a64_op(cg, "add");
+			a64_reg(cg, dst);
+			emit_literal(cg->out, ", ");
+			a64_reg(cg, dst);
+			emit_literal(cg->out, ", ");
+			if (elf) emit_literal(cg->out, ":lo12:");
+			codegen_symbol(cg, inst->entity);
+			if (!elf) emit_literal(cg->out, "@PAGEOFF");
+			a64_end(cg);
+		}
+		a64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_load: {
+		uint32_t base = a64_use(cg, inst->src1, a64_scratch0);
+		uint32_t dst = a64_def(cg, inst->dst);
+		a64_load_store(cg, a64_ldr, dst, base, inst->imm, dst);
+		a64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_store: {
+		uint32_t value = a64_use(cg, inst->src1, a64_scratch0);
+		uint32_t base = a64_use(cg, inst->src2, a64_scratch1);
+		a64_load_store(cg, a64_str, value, base, inst->imm, value == a64_scratch0 ? a64_scratch1 : a64_scratch0);
+		break;
+	}
+
+	case inst_kind_call: {
+		uint32_t callee = a64_use(cg, inst->src1, a64_scratch0);
+		if (cg->object) {
+			a64_encode(cg, 0xd63f0000 | callee << 5);
+		} else {
+			a64_op(cg, "blr");
+			a64_reg(cg, callee);
+			a64_end(cg);
+		}
+		break;
+	}
+
+	case inst_kind_call_direct:
+		if (cg->object) {
+			codegen_relocate(cg, inst->entity, elf_reloc_aarch64_call26, 0);
+			a64_encode(cg, 0x94000000);
+		} else {
+			a64_op(cg, "bl");
+			codegen_symbol(cg, inst->entity);
+			a64_end(cg);
+		}
+		break;
+
+	case inst_kind_return:
+		if (inst != cg->insts + cg->inst_count - 1) a64_branch_to_return(cg);
+		break;
+	}
+}
+
+static void a64_proc(struct codegen *cg) {
+	size_t saved_offset = cg->proc->locals_size + cg->spill_size;
+	size_t saved_size = 8 * (size_t)__builtin_popcount(cg->used_callee_saved);
+	size_t frame_size = round_up(saved_offset + saved_size + round_up(cg->outgoing_size, 16), 16);
+
+	a64_fixed(cg, "\tstp x29, x30, [sp, #-16]!\n", 0xa9bf7bfd);
+	a64_fixed(cg, "\tmov x29, sp\n", 0x910003fd);
+	if (frame_size > 0) a64_add_offset(cg, a64_sp, a64_sp, -(int64_t)frame_size);
+
+	size_t offset = saved_offset;
+	for (uint32_t reg = 0; reg < 32; reg++) {
+		if (!(cg->used_callee_saved & (1u << reg))) continue;
+		offset += 8;
+		a64_frame_store(cg, reg, offset);
+	}
+
+	for (size_t i = 0; i < cg->inst_count; i++) {
+		a64_inst(cg, cg->insts + i);
+	}
+
+	a64_place_return_label(cg);
+
+	offset = saved_offset;
+	for (uint32_t reg = 0; reg < 32; reg++) {
+		if (!(cg->used_callee_saved & (1u << reg))) continue;
+		offset += 8;
+		a64_load_store(cg, a64_ldr, reg, a64_fp, -(int64_t)offset, reg);
+	}
+
+	a64_fixed(cg, "\tmov sp, x29\n", 0x910003bf);
+	a64_fixed(cg, "\tldp x29, x30, [sp], #16\n", 0xa8c17bfd);
+	a64_fixed(cg, "\tret\n", 0xd65f03c0);
+}
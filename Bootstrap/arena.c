@@ -1,30 +1,154 @@
-static uint8_t *arena_start;
-static uint8_t *arena_used;
-static uint8_t *arena_end;
+// An arena is a list of chunks, each a large reservation of address space
+// whose pages are committed as allocations reach them, so a chunk grows in place.
+// Memory past the used pointer is always zero: fresh pages come zeroed,
+// and resetting to a mark clears what was released.
 
-static const size_t default_chunk_size = 64 * 1024;
+struct arena_chunk {
+	struct arena_chunk *prev;
+	uint8_t *used;
+	uint8_t *committed;
+	uint8_t *end;
+};
+
+struct arena {
+	struct arena_chunk *chunk;
+};
+
+struct arena_mark {
+	struct arena_chunk *chunk;
+	uint8_t *used;
+};
+
+struct arena_stats {
+	size_t reserved;
+	size_t committed;
+	size_t used;
+};
+
+static const size_t arena_reserve_size = (size_t)16 << 30;
+static const size_t arena_commit_size = 256 * 1024;
+
+// Lives for the whole compilation.
+static struct arena main_arena;
+
+// Short-lived allocations, released with arena_reset once a phase or procedure is done.
+// Every thread has its own.
+static _Thread_local struct arena scratch_arena;
+
+// Where push_size allocates; worker threads point it at arenas of their own.
+static _Thread_local struct arena *thread_arena = &main_arena;
 
 static size_t pad_pow2(uintptr_t offset, size_t align) {
-	size_t result = offset - (offset & (align - 1));
-	if (result == offset) result = 0;
-	return result;
+	return (align - (offset & (align - 1))) & (align - 1);
 }
 
-static void *push_size(size_t size, size_t align) {
-	size_t padding = pad_pow2((uintptr_t)arena_used, align);
-
-	if (arena_end - arena_used < (ptrdiff_t)(padding + size)) {
-		size_t chunk_size = size + align;
-		chunk_size = default_chunk_size > chunk_size ? default_chunk_size : chunk_size;
-		arena_start = calloc(chunk_size, 1);
-		arena_used = arena_start;
-		arena_end = arena_start + chunk_size;
-		padding = pad_pow2((uintptr_t)arena_used, align);
+static void arena_commit(struct arena_chunk *chunk, uint8_t *until) {
+	size_t size = round_up((size_t)(until - chunk->committed), arena_commit_size);
+	if (size > (size_t)(chunk->end - chunk->committed)) size = (size_t)(chunk->end - chunk->committed);
+	if (mprotect(chunk->committed, size, PROT_READ | PROT_WRITE) != 0) {
+		fprintf(stderr, "ceramic: out of memory\n");
+		exit(1);
 	}
+	chunk->committed += size;
+}
+
+static struct arena_chunk *arena_chunk_create(size_t size) {
+	size_t reserve_size = arena_reserve_size;
+	size_t needed = round_up(sizeof(struct arena_chunk) + size, arena_commit_size);
+	if (reserve_size < needed) reserve_size = needed;
 
-	assert(arena_end - arena_used >= (ptrdiff_t)(padding + size));
-	void *result = arena_used + padding;
+	uint8_t *base = mmap(0, reserve_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "ceramic: out of memory\n");
+		exit(1);
+	}
+
+	struct arena_chunk header = {.committed = base, .end = base + reserve_size};
+	arena_commit(&header, base + sizeof(struct arena_chunk));
+	struct arena_chunk *chunk = (struct arena_chunk *)base;
+	*chunk = header;
+	chunk->used = base + sizeof(struct arena_chunk);
+	return chunk;
+}
+
+static void *arena_push(struct arena *arena, size_t size, size_t align) {
+	struct arena_chunk *chunk = arena->chunk;
+	size_t padding = chunk ? pad_pow2((uintptr_t)chunk->used, align) : 0;
+
+	if (!chunk || (size_t)(chunk->end - chunk->used) < padding + size) {
+		struct arena_chunk *new_chunk = arena_chunk_create(size + align);
+		new_chunk->prev = chunk;
+		arena->chunk = chunk = new_chunk;
+		padding = pad_pow2((uintptr_t)chunk->used, align);
+	}
+
+	uint8_t *result = chunk->used + padding;
+	chunk->used = result + size;
+	if (chunk->used > chunk->committed) arena_commit(chunk, chunk->used);
 	assert(((uintptr_t)result & (align - 1)) == 0);
-	arena_used += padding + size;
 	return result;
 }
+
+// Resizes the most recent allocation, in place when its chunk has room and otherwise by moving it.
+static void *arena_grow(struct arena *arena, void *ptr, size_t old_size, size_t new_size, size_t align) {
+	struct arena_chunk *chunk = arena->chunk;
+	uint8_t *start = ptr;
+	if (start && start + old_size == chunk->used && (size_t)(chunk->end - start) >= new_size) {
+		chunk->used = start + new_size;
+		if (chunk->used > chunk->committed) arena_commit(chunk, chunk->used);
+		return ptr;
+	}
+
+	void *result = arena_push(arena, new_size, align);
+	if (start) memcpy(result, start, old_size);
+	return result;
+}
+
+static struct arena_mark arena_mark(struct arena *arena) {
+	struct arena_mark result = {0};
+	result.chunk = arena->chunk;
+	if (arena->chunk) result.used = arena->chunk->used;
+	return result;
+}
+
+// Releases everything allocated since mark was taken.
+static void arena_reset(struct arena *arena, struct arena_mark mark) {
+	while (arena->chunk != mark.chunk) {
+		struct arena_chunk *chunk = arena->chunk;
+		arena->chunk = chunk->prev;
+		munmap(chunk, (size_t)(chunk->end - (uint8_t *)chunk));
+	}
+
+	struct arena_chunk *chunk = arena->chunk;
+	if (chunk) {
+		memset(mark.used, 0, (size_t)(chunk->used - mark.used));
+		chunk->used = mark.used;
+	}
+}
+
+static void arena_release(struct arena *arena) {
+	arena_reset(arena, (struct arena_mark){0});
+}
+
+// Releases everything but keeps the oldest chunk’s reservation and committed pages for reuse.
+static void arena_clear(struct arena *arena) {
+	struct arena_chunk *oldest = arena->chunk;
+	while (oldest && oldest->prev) oldest = oldest->prev;
+	arena_reset(arena, (struct arena_mark){oldest, oldest ? (uint8_t *)(oldest + 1) : 0});
+}
+
+static struct arena_stats arena_stats(struct arena *arena) {
+	struct arena_stats result = {0};
+	for (struct arena_chunk *chunk = arena->chunk; chunk; chunk = chunk->prev) {
+		uint8_t *base = (uint8_t *)chunk;
+		result.reserved += (size_t)(chunk->end - base);
+		result.committed += (size_t)(chunk->committed - base);
+		result.used += (size_t)(chunk->used - (uint8_t *)(chunk + 1));
+	}
+	return result;
+}
+
+static void *push_size(size_t size, size_t align) {
+	counters.pushed_bytes += size;
+	return arena_push(thread_arena, size, align);
+}
@@ -0,0 +1,507 @@
+// Compiler throughput benchmarks, built with optimizations and without sanitizers by ./bench.
+// The compiler is included whole so that its internal functions can be timed directly.
+// `./bench --save` records the compile results as a baseline that later runs are compared against.
+// `./bench --runtime` instead measures how fast the generated code runs.
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+int ceramic_main(int argc, char **argv);
+#define main ceramic_main
+#include "main.c"
+#undef main
+
+static double bench_seconds(void) {
+	struct timespec ts = {0};
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Source shaped like generated code: long names, deep indentation and blank lines.
+static char *bench_lex_source(size_t proc_count, size_t *size) {
+	static const char template[] =
+	        "proc generated_procedure_%zu(first_argument_value: int, second_argument_value: int) int {\n"
+	        "\t\tintermediate_result_value := first_argument_value * 1234567 + second_argument_value\n\n"
+	        "\t\tresult_pointer_value: *int = *intermediate_result_value\n"
+	        "\t\treturn result_pointer_value^ / 89                                  \n"
+	        "}\n\n";
+	size_t capacity = proc_count * (sizeof(template) + 20);
+	char *source = push_array(char, capacity);
+	size_t length = 0;
+	for (size_t i = 0; i < proc_count; i++) {
+		length += (size_t)snprintf(source + length, capacity - length, template, i);
+	}
+	*size = length;
+	return source;
+}
+
+// Walks the source the way lex does, but only calls the scanner.
+static void bench_scan(char *s) {
+	size_t newlines = 0;
+	while (*s) {
+		if (is_space(*s)) {
+			s = scanner->skip_space(s, &newlines);
+		} else if (is_alpha(*s) || *s == '_') {
+			s = scanner->skip_name(s + 1);
+		} else if (is_digit(*s)) {
+			s = scanner->skip_digits(s + 1);
+		} else {
+			s++;
+		}
+	}
+	assert(newlines > 0);
+}
+
+static void bench_lex(void) {
+	size_t size = 0;
+	char *source = bench_lex_source(100 * 1000, &size);
+	const int rounds = 10;
+
+	printf("lex: %zu bytes, MB/s scanning only and for the whole lexer\n", size);
+	for (size_t i = 0; i < countof(scanners); i++) {
+		if (!scanner_supported(scanners + i)) continue;
+		scanner = scanners + i;
+
+		double best_scan = 0;
+		double best_lex = 0;
+		for (int round = 0; round < rounds; round++) {
+			double start = bench_seconds();
+			bench_scan(source);
+			double scan_seconds = bench_seconds() - start;
+
+			start = bench_seconds();
+			struct lexer lexer = lexer_create(source);
+			while (lex(&lexer).kind != token_kind_eof) continue;
+			double lex_seconds = bench_seconds() - start;
+
+			if (round == 0 || scan_seconds < best_scan) best_scan = scan_seconds;
+			if (round == 0 || lex_seconds < best_lex) best_lex = lex_seconds;
+		}
+		printf("  %-8s scan %8.1f  lex %8.1f\n", scanners[i].name, (double)size / best_scan / 1e6,
+		        (double)size / best_lex / 1e6);
+	}
+
+	struct arena_stats stats = arena_stats(&main_arena);
+	printf("  arena: %zu bytes reserved, %zu committed, %zu used\n", stats.reserved, stats.committed, stats.used);
+}
+
+struct bench_buffer {
+	char *data;
+	size_t length;
+	size_t capacity;
+};
+
+__attribute__((format(printf, 2, 3))) static void bench_printf(struct bench_buffer *buffer, char *fmt, ...) {
+	while (true) {
+		va_list ap;
+		va_start(ap, fmt);
+		int length = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, fmt, ap);
+		va_end(ap);
+		if ((size_t)length < buffer->capacity - buffer->length) {
+			buffer->length += (size_t)length;
+			return;
+		}
+		buffer->capacity = buffer->capacity == 0 ? 1024 * 1024 : 2 * buffer->capacity;
+		buffer->data = realloc(buffer->data, buffer->capacity);
+	}
+}
+
+static uint32_t bench_random(uint64_t *state, uint32_t n) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return (uint32_t)((*state * 0x2545f4914f6cdd1d) >> 32) % n;
+}
+
+// Integer-valued operands in scope and the procedures an expression may call.
+struct bench_scope {
+	char operands[64][16];
+	uint32_t operand_count;
+	uint32_t leaf_count;
+	bool has_callback;
+};
+
+static void bench_operand(struct bench_buffer *buffer, uint64_t *state, struct bench_scope *scope) {
+	if (bench_random(state, 5) == 0) {
+		bench_printf(buffer, "%u", bench_random(state, 1000));
+	} else {
+		bench_printf(buffer, "%s", scope->operands[bench_random(state, scope->operand_count)]);
+	}
+}
+
+static void bench_expression(struct bench_buffer *buffer, uint64_t *state, struct bench_scope *scope, int depth) {
+	uint32_t choice = bench_random(state, 8);
+	if (depth == 0 || choice == 0) {
+		bench_operand(buffer, state, scope);
+	} else if (choice == 1 && (scope->leaf_count > 0 || scope->has_callback)) {
+		if (scope->has_callback && bench_random(state, 2) == 0) {
+			bench_printf(buffer, "f(");
+		} else {
+			bench_printf(buffer, "leaf%u(", bench_random(state, scope->leaf_count));
+		}
+		bench_expression(buffer, state, scope, depth - 1);
+		bench_printf(buffer, ", ");
+		bench_expression(buffer, state, scope, depth - 1);
+		bench_printf(buffer, ")");
+	} else {
+		static const char operators[] = "+-*/";
+		bench_printf(buffer, "(");
+		bench_expression(buffer, state, scope, depth - 1);
+		bench_printf(buffer, " %c ", operators[bench_random(state, 4)]);
+		bench_expression(buffer, state, scope, depth - 1);
+		bench_printf(buffer, ")");
+	}
+}
+
+static void bench_add_operand(struct bench_scope *scope, char *fmt, uint32_t index) {
+	if (scope->operand_count == countof(scope->operands)) return;
+	snprintf(scope->operands[scope->operand_count++], sizeof(scope->operands[0]), fmt, index);
+}
+
+// Statements shared by every generated body: integer locals, pointers to them and stores through those.
+static void bench_body(struct bench_buffer *buffer, uint64_t *state, struct bench_scope *scope) {
+	uint32_t local_count = 4 + bench_random(state, 12);
+	for (uint32_t i = 0; i < local_count; i++) {
+		bench_printf(buffer, "\tl%u := ", i);
+		bench_expression(buffer, state, scope, 1 + (int)bench_random(state, 6));
+		bench_printf(buffer, "\n");
+		bench_add_operand(scope, "l%u", i);
+
+		if (bench_random(state, 4) == 0) {
+			bench_printf(buffer, "\tp%u: *int = *l%u\n\tp%u^ = ", i, i, i);
+			bench_expression(buffer, state, scope, 3);
+			bench_printf(buffer, "\n");
+			bench_add_operand(scope, "p%u^", i);
+		}
+	}
+	bench_printf(buffer, "\treturn ");
+	bench_expression(buffer, state, scope, 8);
+	bench_printf(buffer, "\n}\n\n");
+}
+
+// A deterministic program of leaf procedures doing arithmetic on locals and pointers,
+// and procedures that take leaf procedures as proc-typed parameters and pass them on.
+static char *bench_program(uint32_t leaf_count, uint32_t apply_count, size_t *line_count) {
+	struct bench_buffer buffer = {0};
+	uint64_t state = 0x9e3779b97f4a7c15;
+
+	for (uint32_t i = 0; i < leaf_count; i++) {
+		struct bench_scope scope = {.leaf_count = i};
+		bench_add_operand(&scope, "a", 0);
+		bench_add_operand(&scope, "b", 0);
+		bench_printf(&buffer, "proc leaf%u(a: int, b: int) int {\n", i);
+		bench_body(&buffer, &state, &scope);
+	}
+
+	for (uint32_t i = 0; i < apply_count; i++) {
+		struct bench_scope scope = {.leaf_count = leaf_count, .has_callback = true};
+		bench_add_operand(&scope, "a", 0);
+		bench_printf(&buffer, "proc apply%u(a: int, f: proc(int, int) int) int {\n", i);
+		if (i > 0) {
+			uint32_t callee = bench_random(&state, i);
+			bench_printf(&buffer, "\tg: proc(int, int) int = leaf%u\n", bench_random(&state, leaf_count));
+			bench_printf(&buffer, "\tn := apply%u(a, g) + apply%u(a, f)\n", callee, callee);
+			bench_add_operand(&scope, "n", 0);
+		}
+		bench_body(&buffer, &state, &scope);
+	}
+	bench_printf(&buffer, "proc main() int {\n\treturn apply%u(1, leaf0)\n}\n", apply_count - 1);
+
+	*line_count = 0;
+	for (size_t i = 0; i < buffer.length; i++) *line_count += buffer.data[i] == '\n';
+	return buffer.data;
+}
+
+struct bench_result {
+	char *name;
+	double value;
+	bool higher_is_better;
+};
+
+static void bench_compile(struct bench_result *results, size_t *result_count) {
+	size_t line_count = 0;
+	char *program = bench_program(4000, 1000, &line_count);
+	const struct target *target = target_find("x86_64-linux");
+	const int rounds = 5;
+
+	double best[3] = {0};
+	size_t node_count = 0;
+	for (int round = 0; round < rounds; round++) {
+		pool_init(1);
+		double start = bench_seconds();
+		struct unit unit = {.stale = true};
+		unit.root = parse(program);
+		double parsed = bench_seconds();
+		struct entity *first_entity = typecheck(&unit);
+		double checked = bench_seconds();
+		codegen(&unit, first_entity, target, true);
+		double generated = bench_seconds();
+
+		node_count = ast.count - 1;
+		double seconds[3] = {parsed - start, checked - parsed, generated - checked};
+		for (size_t i = 0; i < countof(best); i++) {
+			if (round == 0 || seconds[i] < best[i]) best[i] = seconds[i];
+		}
+		serve_reset();
+	}
+	free(program);
+
+	struct rusage usage = {0};
+	getrusage(RUSAGE_SELF, &usage);
+
+	static char *const phase_names[] = {"parse", "typecheck", "codegen"};
+	static char names[countof(best)][2][32];
+	printf("compile: %zu lines, %zu nodes, best of %d rounds\n", line_count, node_count, rounds);
+	for (size_t i = 0; i < countof(best); i++) {
+		double lines_per_second = (double)line_count / best[i];
+		double nodes_per_second = (double)node_count / best[i];
+		printf("  %-10s %8.2f ms %12.0f lines/s %12.0f nodes/s\n", phase_names[i], 1e3 * best[i], lines_per_second,
+		        nodes_per_second);
+		snprintf(names[i][0], sizeof(names[i][0]), "%s_lines_per_second", phase_names[i]);
+		snprintf(names[i][1], sizeof(names[i][1]), "%s_nodes_per_second", phase_names[i]);
+		results[(*result_count)++] = (struct bench_result){names[i][0], lines_per_second, true};
+		results[(*result_count)++] = (struct bench_result){names[i][1], nodes_per_second, true};
+	}
+	printf("  peak RSS %ld KiB\n", usage.ru_maxrss);
+	results[(*result_count)++] = (struct bench_result){"peak_rss_kib", (double)usage.ru_maxrss, false};
+}
+
+static const char bench_baseline_path[] = "bench.baseline";
+
+// Each baseline line holds a result name and its value.
+static void bench_save(struct bench_result *results, size_t result_count) {
+	FILE *file = fopen(bench_baseline_path, "w");
+	if (!file) io_error((char *)bench_baseline_path, "open");
+	for (size_t i = 0; i < result_count; i++) fprintf(file, "%s %.0f\n", results[i].name, results[i].value);
+	if (fclose(file) != 0) io_error((char *)bench_baseline_path, "write");
+	printf("saved baseline to %s\n", bench_baseline_path);
+}
+
+// Flags results more than 15% worse than the baseline and returns whether any were.
+static bool bench_compare(struct bench_result *results, size_t result_count) {
+	FILE *file = fopen(bench_baseline_path, "r");
+	if (!file) return false;
+
+	bool regressed = false;
+	printf("against %s:\n", bench_baseline_path);
+	char name[64];
+	double baseline = 0;
+	while (fscanf(file, "%63s %lf", name, &baseline) == 2) {
+		for (size_t i = 0; i < result_count; i++) {
+			if (strcmp(results[i].name, name) != 0 || baseline == 0) continue;
+			double change = results[i].value / baseline - 1;
+			bool worse = results[i].higher_is_better ? change < -0.15 : change > 0.15;
+			printf("  %-32s %+7.1f%%%s\n", name, 100 * change, worse ? "  regression" : "");
+			regressed |= worse;
+		}
+	}
+	fclose(file);
+	return regressed;
+}
+
+// Programs for measuring generated code. Ceramic has no loops or conditionals,
+// so each kernel is run by a driver whose calls double at every level: drive<n> runs the kernel 2^n times.
+struct bench_program {
+	char *name;
+	char *kernel;
+	uint32_t depth;
+};
+
+static const struct bench_program bench_programs[] = {
+        {"arithmetic",
+                "proc kernel(a: int, b: int) int {\n"
+                "\tx := a * 7 + b\n"
+                "\ty := x * x - a * b + 13\n"
+                "\tz := (y + x) * (y - x) / 3 + (a - b) * 5\n"
+                "\tw := z * 3 + y * 5 - x * 7 + (z - y) / 11\n"
+                "\treturn (w + z) * (x - y) + (w - a) / 9 + b * 17\n"
+                "}\n",
+                23},
+        {"calls",
+                "proc kernel(a: int, b: int) int { return step1(a, b) + step1(b, a); }\n"
+                "proc step1(a: int, b: int) int { return step2(a, b) - step2(a, 1); }\n"
+                "proc step2(a: int, b: int) int { return step3(a + b) + step3(a - b); }\n"
+                "proc step3(a: int) int { return a + 1; }\n",
+                22},
+        {"pointers",
+                "proc kernel(a: int, b: int) int {\n"
+                "\tx := a\n"
+                "\tp: *int = *x\n"
+                "\tpp: **int = *p\n"
+                "\tppp: ***int = *pp\n"
+                "\tppp^^^ = ppp^^^ + b\n"
+                "\tbump(pp)\n"
+                "\tbump(*p)\n"
+                "\treturn pp^^ + ppp^^^ * 2\n"
+                "}\n"
+                "proc bump(pp: **int) { pp^^ = pp^^ + 3; }\n",
+                23},
+        {"indirect",
+                "proc kernel(a: int, b: int) int {\n"
+                "\tf: proc(int, int) int = add\n"
+                "\tg: proc(int, int) int = sub\n"
+                "\th: proc(proc(int, int) int, int) int = twice\n"
+                "\treturn h(f, a) + h(g, b) + f(g(a, b), b)\n"
+                "}\n"
+                "proc twice(f: proc(int, int) int, a: int) int { return f(f(a, 1), 2); }\n"
+                "proc add(a: int, b: int) int { return a + b; }\n"
+                "proc sub(a: int, b: int) int { return a - b; }\n",
+                22},
+};
+
+static char *bench_runtime_source(const struct bench_program *program) {
+	struct bench_buffer buffer = {0};
+	bench_printf(&buffer, "%s", program->kernel);
+	bench_printf(&buffer, "proc drive0(a: int) int { return kernel(a, 3); }\n");
+	for (uint32_t i = 1; i <= program->depth; i++) {
+		bench_printf(&buffer, "proc drive%u(a: int) int { return drive%u(a) + drive%u(a + 1); }\n", i, i - 1, i - 1);
+	}
+	bench_printf(&buffer, "proc main() int { return drive%u(5); }\n", program->depth);
+	return buffer.data;
+}
+
+// Runs the executable to completion and returns its user-space instruction count,
+// or -1 if the kernel does not let us count them.
+static int64_t bench_run(char *path, double *seconds) {
+	int ready[2];
+	if (pipe(ready) != 0) io_error(path, "run");
+	pid_t pid = fork();
+	if (pid < 0) io_error(path, "run");
+	if (pid == 0) {
+		char c = 0;
+		close(ready[1]);
+		if (read(ready[0], &c, 1) < 0) _exit(127);
+		execl(path, path, (char *)0);
+		_exit(127);
+	}
+	close(ready[0]);
+
+	int counter = -1;
+#if defined(__linux__)
+	// The counter starts when the child execs, so fork and the wait above are not counted.
+	struct perf_event_attr attr = {
+	        .type = PERF_TYPE_HARDWARE,
+	        .size = sizeof(attr),
+	        .config = PERF_COUNT_HW_INSTRUCTIONS,
+	        .disabled = 1,
+	        .enable_on_exec = 1,
+	        .exclude_kernel = 1,
+	        .exclude_hv = 1,
+	};
+	counter = (int)syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+#endif
+
+	double start = bench_seconds();
+	if (write(ready[1], "", 1) != 1) io_error(path, "run");
+	close(ready[1]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+	*seconds = bench_seconds() - start;
+	if (!WIFEXITED(status)) {
+		fprintf(stderr, "bench: %s did not exit normally\n", path);
+		exit(1);
+	}
+
+	int64_t result = -1;
+	if (counter >= 0) {
+		uint64_t count = 0;
+		if (read(counter, &count, sizeof(count)) == sizeof(count)) result = (int64_t)count;
+		close(counter);
+	}
+	return result;
+}
+
+static void bench_runtime(void) {
+	const struct target *target = target_find(default_target_name);
+	if (!target->elf) {
+		printf("runtime: needs an ELF target, skipped on %s\n", target->name);
+		return;
+	}
+
+	char directory[] = "/tmp/ceramic-bench-XXXXXX";
+	if (!mkdtemp(directory)) io_error(directory, "create");
+	char *cc = getenv("CC");
+	if (!cc) cc = "cc";
+	const int rounds = 5;
+
+	printf("runtime on %s: best of %d runs\n", target->name, rounds);
+	printf("  %-12s %10s %16s %12s\n", "program", "ms", "instructions", "kernel bytes");
+	for (size_t i = 0; i < countof(bench_programs); i++) {
+		const struct bench_program *program = bench_programs + i;
+		char object_path[64];
+		char executable_path[64];
+		snprintf(object_path, sizeof(object_path), "%s/%s.o", directory, program->name);
+		snprintf(executable_path, sizeof(executable_path), "%s/%s", directory, program->name);
+
+		char *source = bench_runtime_source(program);
+		pool_init(1);
+		struct unit unit = {.stale = true};
+		unit.root = parse(source);
+		struct entity *first_entity = typecheck(&unit);
+		codegen(&unit, first_entity, target, true);
+		// The kernel’s procedures come before the driver’s.
+		size_t code_size = 0;
+		for (struct entity *entity = first_entity; strcmp(entity->name, "drive0") != 0; entity = entity->next) {
+			code_size += entity->symbol->size;
+		}
+		emit_write(unit.out, object_path);
+		serve_reset();
+		free(source);
+
+		char command[256];
+		snprintf(command, sizeof(command), "%s -o %s %s", cc, executable_path, object_path);
+		if (system(command) != 0) {
+			fprintf(stderr, "bench: cannot link %s\n", object_path);
+			exit(1);
+		}
+
+		double best = 0;
+		int64_t instructions = -1;
+		for (int round = 0; round < rounds; round++) {
+			double seconds = 0;
+			int64_t count = bench_run(executable_path, &seconds);
+			if (round == 0 || seconds < best) best = seconds;
+			if (count >= 0 && (instructions < 0 || count < instructions)) instructions = count;
+		}
+
+		char instruction_text[32] = "n/a";
+		if (instructions >= 0) snprintf(instruction_text, sizeof(instruction_text), "%lld", (long long)instructions);
+		printf("  %-12s %10.2f %16s %12zu\n", program->name, 1e3 * best, instruction_text, code_size);
+		unlink(object_path);
+		unlink(executable_path);
+	}
+	rmdir(directory);
+}
+
+int main(int argc, char **argv) {
+	bool save = argc == 2 && strcmp(argv[1], "--save") == 0;
+	bool runtime = argc == 2 && strcmp(argv[1], "--runtime") == 0;
+	if (argc > 2 || (argc == 2 && !save && !runtime)) {
+		fprintf(stderr, "usage: bench [--save | --runtime]\n");
+		return 1;
+	}
+	if (runtime) {
+		bench_runtime();
+		return 0;
+	}
+
+	bench_lex();
+	serve_reset();
+
+	struct bench_result results[16];
+	size_t result_count = 0;
+	bench_compile(results, &result_count);
+	if (save) {
+		bench_save(results, result_count);
+	} else if (bench_compare(results, result_count)) {
+		return 1;
+	}
+	return 0;
+}
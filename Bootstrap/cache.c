@@ -0,0 +1,132 @@
+// Generated code is cached on disk per procedure, keyed by a hash of everything it depends on:
+// the procedure’s syntax tree, the signatures of the procedures it names, the bodies of those
+// it may inline, and the output format.
+// Entries are written to a temporary file and renamed into place,
+// so a compiler running concurrently never reads a partial entry.
+
+// Bump whenever code generation changes, so stale entries stop matching.
+static const uint64_t cache_version = 3;
+
+static char *cache_directory;
+static atomic_size_t cache_hits;
+static atomic_size_t cache_misses;
+
+struct cache_key {
+	uint64_t hash[2];
+};
+
+struct cache_reader {
+	uint8_t *at;
+	uint8_t *end;
+};
+
+static void cache_init(char *directory) {
+	if (mkdir(directory, 0777) != 0 && errno != EEXIST) io_error(directory, "create");
+	cache_directory = directory;
+}
+
+static void cache_reset(void) {
+	cache_directory = 0;
+	atomic_store(&cache_hits, 0);
+	atomic_store(&cache_misses, 0);
+}
+
+// Depth counts the inlined bodies node is nested in, as seen from proc.
+static uint64_t cache_hash_node(uint64_t hash, uint32_t node, struct entity *proc, uint32_t depth) {
+	if (node_is_nil(node)) return hash_combine(hash, 0);
+
+	enum node_kind kind = node_kind(node);
+	hash = hash_combine(hash, kind);
+	if (kind == node_kind_number) {
+		hash = hash_combine(hash, ast.data[node].value);
+	} else if (ast.data[node].name) {
+		char *name = ast.data[node].name;
+		hash = hash_combine(hash, hash_bytes(name, strlen(name)));
+	}
+
+	// A change to a callee’s signature can change the code of its callers,
+	// and so can a change to the body of a callee that may be inlined into them.
+	struct entity *entity = node_entity(node);
+	if (entity) {
+		hash = hash_combine(hash, entity->type->hash);
+		if (depth < inline_depth_limit && ir_can_inline(proc, entity)) {
+			hash = cache_hash_node(hash, entity->node, proc, depth + 1);
+		}
+	}
+
+	if (node_has_list(kind)) {
+		struct node_list list = node_list(node);
+		hash = hash_combine(hash, list.count);
+		for (uint32_t i = 0; i < list.count; i++) hash = cache_hash_node(hash, list.nodes[i], proc, depth);
+	} else if (kind != node_kind_name && kind != node_kind_number) {
+		hash = cache_hash_node(hash, node_a(node), proc, depth);
+		hash = cache_hash_node(hash, node_b(node), proc, depth);
+	}
+	return hash;
+}
+
+static struct cache_key cache_key(struct entity *proc, const char *target_name, bool emit_object) {
+	struct cache_key result = {0};
+	for (size_t i = 0; i < countof(result.hash); i++) {
+		uint64_t hash = hash_combine(i, cache_version);
+		hash = hash_combine(hash, hash_bytes(target_name, strlen(target_name)));
+		hash = hash_combine(hash, emit_object);
+		result.hash[i] = cache_hash_node(hash, proc->node, proc, 0);
+	}
+	return result;
+}
+
+static char *cache_path(struct cache_key key, char *suffix) {
+	size_t size = strlen(cache_directory) + strlen(suffix) + 34;
+	char *result = arena_push_array(&scratch_arena, char, size);
+	snprintf(result, size, "%s/%016llx%016llx%s", cache_directory, (unsigned long long)key.hash[0],
+	        (unsigned long long)key.hash[1], suffix);
+	return result;
+}
+
+// Returns a reader over the entry’s payload, which lives in the scratch arena,
+// or a reader with no data if there is no valid entry.
+static struct cache_reader cache_load(struct cache_key key) {
+	struct cache_reader result = {0};
+	char *path = cache_path(key, "");
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return result;
+
+	struct stat st = {0};
+	if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(key)) {
+		size_t size = (size_t)st.st_size;
+		uint8_t *data = arena_push_array(&scratch_arena, uint8_t, size);
+		size_t length = 0;
+		while (length < size) {
+			ssize_t n = read(fd, data + length, size - length);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			length += (size_t)n;
+		}
+		if (length == size && memcmp(data, &key, sizeof(key)) == 0) {
+			result.at = data + sizeof(key);
+			result.end = data + size;
+		}
+	}
+	close(fd);
+	return result;
+}
+
+static bool cache_read(struct cache_reader *reader, void *bytes, size_t size) {
+	if ((size_t)(reader->end - reader->at) < size) return false;
+	memcpy(bytes, reader->at, size);
+	reader->at += size;
+	return true;
+}
+
+static void cache_store(struct cache_key key, struct emitter *payload) {
+	struct emitter entry = {0};
+	emit_bytes(&entry, (char *)&key, sizeof(key));
+	emit_append(&entry, payload);
+
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%ld.tmp", (long)getpid());
+	char *temporary_path = cache_path(key, suffix);
+	emit_write(&entry, temporary_path);
+	if (rename(temporary_path, cache_path(key, "")) != 0) io_error(temporary_path, "rename");
+}
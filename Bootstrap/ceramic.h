@@ -1,8 +1,25 @@
+struct arena;
+static void *arena_push(struct arena *arena, size_t size, size_t align);
 static void *push_size(size_t size, size_t align);
 
+#define arena_push_array(arena, T, count) ((T *)arena_push((arena), (count) * sizeof(T), alignof(T)))
+#define arena_push_struct(arena, T) arena_push_array(arena, T, 1)
 #define push_array(T, count) ((T *)push_size((count) * sizeof(T), alignof(T)))
 #define push_struct(T) push_array(T, 1)
 
+// Event counts for --stats, kept per thread so hot paths need no atomics.
+// Pool threads add theirs to the process totals when they finish.
+struct counters {
+	size_t tokens;
+	size_t pushed_bytes;
+	size_t type_lookups;
+	size_t type_hits;
+	size_t scope_lookups;
+};
+
+static _Thread_local struct counters counters;
+static void counters_retire(void);
+
 enum node_kind {
 	node_kind_nil,
 	node_kind_root,
@@ -66,7 +83,7 @@ struct type_node {
 };
 
 struct type {
-	struct type *next_interned;
+	uint64_t hash;
 	enum type_kind kind;
 	struct type *inner;
 	struct type_node *first;
@@ -76,44 +93,98 @@ struct local {
 	struct local *next;
 	char *name;
 	struct type *type;
+	bool address_taken;
 	size_t offset;
+	struct ir_inst *value;
 };
 
-struct node {
-	struct node *next;
-	struct node *first;
-	struct node *last;
-	enum node_kind kind;
-	char *name;
-	uint64_t value;
-	size_t line;
+// The AST is a pool of nodes addressed by 32-bit indices, stored as one array per field.
+// Index 0 is the nil node. Each node has two fixed child slots whose meaning depends on its kind:
+//   proc: signature (a proc_type whose params are param nodes), block
+//   proc_type: params, return type (a type node, or nil)
+//   param: type expression
+//   local: type node or nil, initializer node or nil
+//   type, initializer, expr_stmt, address, deref: operand
+//   return: value or nil
+//   assign, add, sub, mul, div: left, right
+// Root, block and params nodes and calls instead hold a list, stored in the extra array
+// as the index of its first element and its length. The first element of a call is the callee.
+struct ast {
+	uint8_t *kinds;
+	uint32_t *lines;
+	uint32_t (*kids)[2];
+	union node_data {
+		char *name;
+		uint64_t value;
+	} *data;
+	struct type **types;
+	struct symbol **symbols;
+	uint32_t count;
+	uint32_t capacity;
 
-	struct type *type;
+	uint32_t *extra;
+	uint32_t extra_count;
+	uint32_t extra_capacity;
+};
+
+// Which declaration a name or local node refers to, filled in by the type checker.
+struct symbol {
+	struct symbol *next;
 	struct local *local;
 	struct entity *entity;
 };
 
-static const struct node node_nil = {
-        .next = (struct node *)&node_nil,
-        .first = (struct node *)&node_nil,
-        .last = (struct node *)&node_nil,
+static struct ast ast;
+
+struct node_list {
+	uint32_t *nodes;
+	uint32_t count;
 };
 
-static bool node_is_nil(struct node *node);
-static struct node *node_find(struct node *node, enum node_kind kind);
-static size_t node_kid_count(struct node *node);
-__attribute__((unused)) static void node_print(struct node *node);
+static enum node_kind node_kind(uint32_t node);
+static size_t node_line(uint32_t node);
+static uint32_t node_a(uint32_t node);
+static uint32_t node_b(uint32_t node);
+static struct node_list node_list(uint32_t node);
+static bool node_is_nil(uint32_t node);
+__attribute__((unused)) static void node_print(uint32_t node);
 
-static struct node *parse(char *s);
+static uint32_t parse(char *s);
 
 struct param {
 	struct param *next;
 	char *name;
-	struct node *node;
+	uint32_t node;
 	struct type *type;
 	struct local *local;
 };
 
+// One source file of a compilation, with an output of its own.
+// A unit is stale when its output has to be regenerated; fresh units are parsed
+// for their signatures but neither checked nor compiled.
+struct unit {
+	struct unit *next;
+	char *source_path;
+	char *output_path;
+	char *record_path;
+	// Prefixes the unit’s diagnostics; a compilation of a single unit leaves it null.
+	char *name;
+	bool stale;
+	uint64_t source_hash;
+	uint32_t root;
+	uint32_t first_node;
+	uint32_t end_node;
+	struct unit_import *first_import;
+	struct emitter *out;
+};
+
+// A procedure of another unit and the signature it had when the unit was last compiled.
+struct unit_import {
+	struct unit_import *next;
+	char *name;
+	uint64_t signature;
+};
+
 enum entity_kind {
 	entity_kind_proc,
 };
@@ -122,17 +193,102 @@ struct entity {
 	struct entity *next;
 	enum entity_kind kind;
 	char *name;
-	struct node *node;
+	uint32_t node;
 
 	struct param *first_param;
 	size_t param_count;
 	struct type *type;
-	struct node *body;
+	uint32_t body;
+	uint32_t body_size;
 	struct local *first_local;
 	size_t locals_size;
+	struct object_symbol *symbol;
+	struct unit *unit;
+	struct unit *last_importer;
 };
 
 static void type_list_push(struct type_node **first, struct type_node **last, struct type_node *node);
-static struct entity *typecheck(struct node *root);
+static struct entity *typecheck(struct unit *first_unit);
+
+enum ir_op {
+	ir_op_const,
+	ir_op_param,
+	ir_op_local,
+	ir_op_proc,
+	ir_op_load,
+	ir_op_store,
+	ir_op_add,
+	ir_op_sub,
+	ir_op_mul,
+	ir_op_div,
+	ir_op_call,
+	ir_op_ret,
+};
+
+static char *const ir_op_strings[] = {
+        [ir_op_const] = "const",
+        [ir_op_param] = "param",
+        [ir_op_local] = "local",
+        [ir_op_proc] = "proc",
+        [ir_op_load] = "load",
+        [ir_op_store] = "store",
+        [ir_op_add] = "add",
+        [ir_op_sub] = "sub",
+        [ir_op_mul] = "mul",
+        [ir_op_div] = "div",
+        [ir_op_call] = "call",
+        [ir_op_ret] = "ret",
+};
+
+struct ir_inst {
+	struct ir_inst *next;
+	enum ir_op op;
+	bool has_value;
+	uint32_t id;
+
+	uint64_t imm;
+	struct local *local;
+	struct entity *entity;
+	struct ir_inst *a;
+	struct ir_inst *b;
+	struct ir_inst **args;
+	size_t arg_count;
+
+	struct ir_inst *replacement;
+};
+
+struct ir_block {
+	struct ir_block *next;
+	uint32_t id;
+	struct ir_inst *first;
+	struct ir_inst *last;
+};
+
+// Whether a direct call was inlined, kept for --inline-report. Reason is null for calls that were.
+struct ir_inline_decision {
+	struct ir_inline_decision *next;
+	size_t line;
+	struct entity *callee;
+	uint32_t size;
+	char *reason;
+};
+
+struct ir_proc {
+	struct ir_proc *next;
+	struct entity *entity;
+	struct ir_block *first_block;
+	struct ir_block *last_block;
+	uint32_t value_count;
+	uint32_t block_count;
+	struct ir_inline_decision *first_decision;
+	struct ir_inline_decision *last_decision;
+};
+
+static struct ir_proc *ir_build(struct entity *first_entity);
+static void ir_dump(struct ir_proc *first_proc, FILE *file);
+static void ir_fold(struct ir_proc *first_proc);
+
+struct emitter;
+struct target;
 
-static void codegen(struct entity *first_entity, FILE *file);
+static void codegen(struct unit *first_unit, struct entity *first_entity, const struct target *target, bool emit_object);
@@ -1,181 +1,830 @@
-static void codegen_node_address(struct entity *proc, struct node *node, FILE *file);
+enum inst_kind {
+	inst_kind_mov,
+	inst_kind_mov_imm,
+	inst_kind_add,
+	inst_kind_sub,
+	inst_kind_mul,
+	inst_kind_sdiv,
+	inst_kind_frame_address,
+	inst_kind_symbol_address,
+	inst_kind_load,
+	inst_kind_store,
+	inst_kind_call,
+	inst_kind_call_direct,
+	inst_kind_return,
+};
 
-static void codegen_node(struct entity *proc, struct node *node, FILE *file) {
-	switch (node->kind) {
-	case node_kind_name:
-		if (node->local) {
-			fprintf(file, "\tldr x9, [x29, #-%zu]\n", node->local->offset);
+// Registers below reg_virtual_first are the target’s physical registers numbered as in its encoding;
+// the rest are virtual registers numbered in order of definition.
+struct inst {
+	enum inst_kind kind;
+	uint32_t dst;
+	uint32_t src1;
+	uint32_t src2;
+	int64_t imm;
+	struct entity *entity;
+};
+
+static const uint32_t reg_none = UINT32_MAX;
+static const uint32_t reg_virtual_first = 32;
+
+enum target_arch {
+	target_arch_aarch64,
+	target_arch_x86_64,
+};
+
+// Values are returned in physical register 0 on every target.
+// Registers used as scratch by the emitters are never allocated;
+// caller-saved registers that also pass arguments are only allocated between the uses of arguments.
+struct target {
+	char *name;
+	enum target_arch arch;
+	bool elf;
+	uint16_t elf_machine;
+	const uint32_t *arg_regs;
+	uint32_t arg_reg_count;
+	uint32_t fp;
+	uint32_t sp;
+	uint32_t caller_saved_regs;
+	uint32_t callee_saved_regs;
+};
+
+static const uint32_t a64_arg_regs[] = {0, 1, 2, 3, 4, 5, 6, 7};
+static const uint32_t x64_arg_regs[] = {7, 6, 2, 1, 8, 9};
+
+static const struct target targets[] = {
+        {
+                .name = "aarch64-macos",
+                .arch = target_arch_aarch64,
+                .arg_regs = a64_arg_regs,
+                .arg_reg_count = countof(a64_arg_regs),
+                .fp = 29,
+                .sp = 31,
+                .caller_saved_regs = 0x7f << 9,
+                .callee_saved_regs = 0x3ff << 19,
+        },
+        {
+                .name = "aarch64-linux",
+                .arch = target_arch_aarch64,
+                .elf = true,
+                .elf_machine = elf_machine_aarch64,
+                .arg_regs = a64_arg_regs,
+                .arg_reg_count = countof(a64_arg_regs),
+                .fp = 29,
+                .sp = 31,
+                .caller_saved_regs = 0x7f << 9,
+                .callee_saved_regs = 0x3ff << 19,
+        },
+        {
+                .name = "x86_64-linux",
+                .arch = target_arch_x86_64,
+                .elf = true,
+                .elf_machine = elf_machine_x86_64,
+                .arg_regs = x64_arg_regs,
+                .arg_reg_count = countof(x64_arg_regs),
+                .fp = 5,
+                .sp = 4,
+                .caller_saved_regs = 1 << 1 | 3 << 6 | 7 << 8,
+                .callee_saved_regs = 1 << 3 | 0xf << 12,
+        },
+};
+
+#if defined(__APPLE__)
+static const char *const default_target_name = "aarch64-macos";
+#elif defined(__x86_64__)
+static const char *const default_target_name = "x86_64-linux";
+#else
+static const char *const default_target_name = "aarch64-linux";
+#endif
+
+static const struct target *target_find(const char *name) {
+	for (size_t i = 0; i < countof(targets); i++) {
+		if (strcmp(targets[i].name, name) == 0) return targets + i;
+	}
+	return 0;
+}
+
+struct interval {
+	size_t start;
+	size_t end;
+	bool crosses_call;
+	uint32_t reg;
+	size_t spill_offset;
+};
+
+struct branch_fixup {
+	struct branch_fixup *next;
+	size_t offset;
+};
+
+// A reference from a procedure’s code to another procedure,
+// resolved to an object symbol once the code is placed in the object.
+struct codegen_relocation {
+	struct codegen_relocation *next;
+	size_t offset;
+	struct entity *entity;
+	uint32_t type;
+	int64_t addend;
+};
+
+// Procedures are generated independently, each into an output of its own,
+// and the outputs are joined in source order afterwards.
+struct codegen_output {
+	struct emitter out;
+	struct object object;
+	struct codegen_relocation *first_relocation;
+	struct codegen_relocation *last_relocation;
+	struct ir_inline_decision *first_decision;
+};
+
+// Code is written either as assembly text to out or as machine code into object.
+struct codegen {
+	const struct target *target;
+	struct codegen_output *output;
+	struct emitter *out;
+	struct object *object;
+	struct entity *proc;
+	uint32_t *value_regs;
+	uint32_t *uses;
+
+	struct inst *insts;
+	size_t inst_count;
+	size_t inst_capacity;
+	uint32_t vreg_count;
+	size_t outgoing_size;
+
+	struct interval *intervals;
+	size_t spill_size;
+	uint32_t used_callee_saved;
+
+	struct branch_fixup *return_branches;
+};
+
+static void a64_proc(struct codegen *cg);
+static void x64_proc(struct codegen *cg);
+
+static struct inst *inst_push(struct codegen *cg, enum inst_kind kind) {
+	assert(cg->inst_count <= cg->inst_capacity);
+	if (cg->inst_count == cg->inst_capacity) {
+		cg->inst_capacity = cg->inst_capacity == 0 ? 64 : 2 * cg->inst_capacity;
+		cg->insts = arena_grow(&scratch_arena, cg->insts, sizeof(struct inst) * cg->inst_count,
+		        sizeof(struct inst) * cg->inst_capacity, alignof(struct inst));
+	}
+	struct inst *inst = cg->insts + cg->inst_count;
+	cg->inst_count++;
+	*inst = (struct inst){.kind = kind, .dst = reg_none, .src1 = reg_none, .src2 = reg_none};
+	return inst;
+}
+
+static uint32_t vreg_make(struct codegen *cg) {
+	uint32_t result = reg_virtual_first + cg->vreg_count;
+	cg->vreg_count++;
+	return result;
+}
+
+static uint32_t inst_def(struct codegen *cg, enum inst_kind kind, uint32_t src1, uint32_t src2) {
+	struct inst *inst = inst_push(cg, kind);
+	inst->dst = vreg_make(cg);
+	inst->src1 = src1;
+	inst->src2 = src2;
+	return inst->dst;
+}
+
+static void inst_mov(struct codegen *cg, uint32_t dst, uint32_t src) {
+	struct inst *inst = inst_push(cg, inst_kind_mov);
+	inst->dst = dst;
+	inst->src1 = src;
+}
+
+static void inst_store(struct codegen *cg, uint32_t value, uint32_t base, int64_t offset) {
+	struct inst *inst = inst_push(cg, inst_kind_store);
+	inst->src1 = value;
+	inst->src2 = base;
+	inst->imm = offset;
+}
+
+static uint32_t inst_load(struct codegen *cg, uint32_t base, int64_t offset) {
+	uint32_t dst = inst_def(cg, inst_kind_load, base, reg_none);
+	cg->insts[cg->inst_count - 1].imm = offset;
+	return dst;
+}
+
+// Constants are materialized where they are first used, which keeps their live ranges short.
+static uint32_t codegen_value(struct codegen *cg, struct ir_inst *value) {
+	uint32_t result = cg->value_regs[value->id];
+	if (result == reg_none && value->op == ir_op_const) {
+		result = inst_def(cg, inst_kind_mov_imm, reg_none, reg_none);
+		cg->insts[cg->inst_count - 1].imm = (int64_t)value->imm;
+		cg->value_regs[value->id] = result;
+	}
+	assert(result != reg_none);
+	return result;
+}
+
+static void codegen_move_to(struct codegen *cg, uint32_t reg, struct ir_inst *value) {
+	if (value->op == ir_op_const && cg->value_regs[value->id] == reg_none && cg->uses[value->id] == 1) {
+		struct inst *inst = inst_push(cg, inst_kind_mov_imm);
+		inst->dst = reg;
+		inst->imm = (int64_t)value->imm;
+	} else {
+		inst_mov(cg, reg, codegen_value(cg, value));
+	}
+}
+
+static bool codegen_is_direct_call(struct ir_inst *inst) {
+	return inst->op == ir_op_call && inst->a->op == ir_op_proc;
+}
+
+static bool codegen_is_frame_access(struct ir_inst *inst) {
+	return (inst->op == ir_op_load || inst->op == ir_op_store) && inst->a->op == ir_op_local;
+}
+
+// Counts the uses of every value by a live instruction, walking backwards so that
+// values only feeding dead instructions end up dead themselves.
+// Procedure addresses used as direct callees and slot addresses used by loads and stores
+// are folded into the instructions using them and don’t count.
+static void codegen_count_uses(struct codegen *cg, struct ir_inst **insts, size_t count) {
+	for (size_t i = count; i > 0; i--) {
+		struct ir_inst *inst = insts[i - 1];
+		if (!ir_has_side_effects(inst) && cg->uses[inst->id] == 0) continue;
+
+		if (inst->a && !codegen_is_direct_call(inst) && !codegen_is_frame_access(inst)) {
+			cg->uses[inst->a->id]++;
+		}
+		if (inst->b) cg->uses[inst->b->id]++;
+		for (size_t j = 0; j < inst->arg_count; j++) {
+			cg->uses[inst->args[j]->id]++;
+		}
+	}
+}
+
+static void codegen_call(struct codegen *cg, struct ir_inst *inst) {
+	const struct target *target = cg->target;
+	uint32_t arg_reg_count = target->arg_reg_count;
+	uint32_t arg_count = (uint32_t)inst->arg_count;
+	if (arg_count > arg_reg_count) {
+		size_t stack_size = 8 * (arg_count - arg_reg_count);
+		if (stack_size > cg->outgoing_size) cg->outgoing_size = stack_size;
+		for (uint32_t i = arg_reg_count; i < arg_count; i++) {
+			inst_store(cg, codegen_value(cg, inst->args[i]), target->sp, 8 * (i - arg_reg_count));
+		}
+	}
+	for (uint32_t i = 0; i < arg_count && i < arg_reg_count; i++) {
+		codegen_move_to(cg, target->arg_regs[i], inst->args[i]);
+	}
+
+	if (codegen_is_direct_call(inst)) {
+		inst_push(cg, inst_kind_call_direct)->entity = inst->a->entity;
+	} else {
+		inst_push(cg, inst_kind_call)->src1 = codegen_value(cg, inst->a);
+	}
+
+	if (inst->has_value && cg->uses[inst->id] > 0) {
+		cg->value_regs[inst->id] = inst_def(cg, inst_kind_mov, 0, reg_none);
+	}
+}
+
+static void codegen_inst(struct codegen *cg, struct ir_inst *inst) {
+	uint32_t result = reg_none;
+
+	switch (inst->op) {
+	case ir_op_const:
+		return;
+
+	case ir_op_param:
+		if (inst->imm < cg->target->arg_reg_count) {
+			result = inst_def(cg, inst_kind_mov, cg->target->arg_regs[inst->imm], reg_none);
 		} else {
-			fprintf(file, "\tadrp x9, _%s@PAGE\n", node->entity->name);
-			fprintf(file, "\tadd x9, x9, _%s@PAGEOFF\n", node->entity->name);
+			// Above the saved frame pointer and return address.
+			int64_t stack_index = (int64_t)(inst->imm - cg->target->arg_reg_count);
+			result = inst_load(cg, cg->target->fp, 16 + 8 * stack_index);
 		}
 		break;
 
-	case node_kind_number:
-		fprintf(file, "\tmov x9, #%llu\n", node->value);
+	case ir_op_local:
+		result = inst_def(cg, inst_kind_frame_address, reg_none, reg_none);
+		cg->insts[cg->inst_count - 1].imm = (int64_t)inst->local->offset;
 		break;
 
-	case node_kind_address:
-		codegen_node_address(proc, node->first, file);
+	case ir_op_proc:
+		result = inst_def(cg, inst_kind_symbol_address, reg_none, reg_none);
+		cg->insts[cg->inst_count - 1].entity = inst->entity;
 		break;
 
-	case node_kind_deref:
-		codegen_node(proc, node->first, file);
-		fprintf(file, "\tldr x9, [x9]\n");
+	case ir_op_load:
+		if (codegen_is_frame_access(inst)) {
+			result = inst_load(cg, cg->target->fp, -(int64_t)inst->a->local->offset);
+		} else {
+			result = inst_load(cg, codegen_value(cg, inst->a), 0);
+		}
 		break;
 
-	case node_kind_call: {
-		int arg_count = 0;
-		for (struct node *arg = node->first->next; !node_is_nil(arg); arg = arg->next) {
-			codegen_node(proc, arg, file);
-			fprintf(file, "\tstr x9, [sp, #-16]!\n");
-			arg_count++;
+	case ir_op_store:
+		if (codegen_is_frame_access(inst)) {
+			inst_store(cg, codegen_value(cg, inst->b), cg->target->fp, -(int64_t)inst->a->local->offset);
+		} else {
+			inst_store(cg, codegen_value(cg, inst->b), codegen_value(cg, inst->a), 0);
 		}
+		break;
 
-		for (int reg = arg_count - 1; reg >= 0; reg--) {
-			fprintf(file, "\tldr x%d, [sp], #16\n", reg);
-		}
+	case ir_op_add:
+	case ir_op_sub:
+	case ir_op_mul:
+	case ir_op_div: {
+		static const enum inst_kind inst_kinds[] = {
+		        [ir_op_add] = inst_kind_add,
+		        [ir_op_sub] = inst_kind_sub,
+		        [ir_op_mul] = inst_kind_mul,
+		        [ir_op_div] = inst_kind_sdiv,
+		};
+		result = inst_def(cg, inst_kinds[inst->op], codegen_value(cg, inst->a), codegen_value(cg, inst->b));
+		break;
+	}
 
-		struct node *callee = node->first;
-		codegen_node(proc, callee, file);
-		fprintf(file, "\tblr x9\n");
+	case ir_op_call:
+		codegen_call(cg, inst);
+		return;
+
+	case ir_op_ret:
+		if (inst->a) codegen_move_to(cg, 0, inst->a);
+		inst_push(cg, inst_kind_return);
 		break;
 	}
 
-	case node_kind_add:
-	case node_kind_sub:
-	case node_kind_mul:
-	case node_kind_div:
-		codegen_node(proc, node->first, file);
-		fprintf(file, "\tstr x9, [sp, #-16]!\n");
-		codegen_node(proc, node->first->next, file);
-		fprintf(file, "\tldr x10, [sp], #16\n");
-		switch (node->kind) {
-		case node_kind_add:
-			fprintf(file, "\tadd x9, x10, x9\n");
-			break;
-		case node_kind_sub:
-			fprintf(file, "\tsub x9, x10, x9\n");
-			break;
-		case node_kind_mul:
-			fprintf(file, "\tmul x9, x10, x9\n");
-			break;
-		case node_kind_div:
-			fprintf(file, "\tsdiv x9, x10, x9\n");
-			break;
-		default:
-			unreachable();
+	if (inst->has_value) cg->value_regs[inst->id] = result;
+}
+
+// Without branches in the language, only the entry block of a procedure is reachable.
+static void codegen_lower(struct codegen *cg, struct ir_proc *proc) {
+	struct ir_block *entry = proc->first_block;
+
+	size_t count = 0;
+	for (struct ir_inst *inst = entry->first; inst; inst = inst->next) count++;
+	struct ir_inst **insts = arena_push_array(&scratch_arena, struct ir_inst *, count);
+	count = 0;
+	for (struct ir_inst *inst = entry->first; inst; inst = inst->next) insts[count++] = inst;
+
+	cg->uses = arena_push_array(&scratch_arena, uint32_t, proc->value_count);
+	cg->value_regs = arena_push_array(&scratch_arena, uint32_t, proc->value_count);
+	for (uint32_t i = 0; i < proc->value_count; i++) cg->value_regs[i] = reg_none;
+	codegen_count_uses(cg, insts, count);
+
+	for (size_t i = 0; i < count; i++) {
+		struct ir_inst *inst = insts[i];
+		if (ir_has_side_effects(inst) || cg->uses[inst->id] > 0) codegen_inst(cg, inst);
+	}
+}
+
+static struct interval *interval_of(struct codegen *cg, uint32_t reg) {
+	assert(reg >= reg_virtual_first && reg != reg_none);
+	return cg->intervals + (reg - reg_virtual_first);
+}
+
+static void interval_extend(struct codegen *cg, uint32_t reg, size_t position) {
+	if (reg == reg_none || reg < reg_virtual_first) return;
+	struct interval *interval = interval_of(cg, reg);
+	if (interval->start == SIZE_MAX) interval->start = position;
+	if (position > interval->end) interval->end = position;
+}
+
+static void interval_spill(struct codegen *cg, struct interval *interval) {
+	interval->reg = reg_none;
+	cg->spill_size += 8;
+	interval->spill_offset = cg->proc->locals_size + cg->spill_size;
+}
+
+// Linear scan over the live intervals of the virtual registers.
+// Code is straight-line, so an interval runs from a register’s only definition to its last use.
+// Intervals that are live across a call must not use caller-saved registers,
+// nor registers that hold an argument meanwhile;
+// when no register is free, the interval ending furthest away is spilled to the frame.
+static void regalloc(struct codegen *cg) {
+	cg->intervals = arena_push_array(&scratch_arena, struct interval, cg->vreg_count);
+	for (uint32_t i = 0; i < cg->vreg_count; i++) {
+		cg->intervals[i] = (struct interval){.start = SIZE_MAX, .reg = reg_none};
+	}
+
+	size_t *calls_before = arena_push_array(&scratch_arena, size_t, cg->inst_count + 1);
+	for (size_t i = 0; i < cg->inst_count; i++) {
+		struct inst *inst = cg->insts + i;
+		interval_extend(cg, inst->dst, i);
+		interval_extend(cg, inst->src1, i);
+		interval_extend(cg, inst->src2, i);
+		bool call = inst->kind == inst_kind_call || inst->kind == inst_kind_call_direct;
+		calls_before[i + 1] = calls_before[i] + call;
+	}
+
+	uint32_t caller_saved_regs = cg->target->caller_saved_regs;
+	uint32_t callee_saved_regs = cg->target->callee_saved_regs;
+
+	// A register read by a parameter holds an argument from the entry, and one written for a call
+	// holds it until the call. Gap i lies after instruction i, and fixed_gaps[r][i] counts
+	// the gaps below i across which r holds an argument.
+	size_t *fixed_gaps[32] = {0};
+	size_t fixed_def[32] = {0};
+	uint32_t pending_regs = 0;
+	for (size_t i = 0; i < cg->inst_count; i++) {
+		struct inst *inst = cg->insts + i;
+		uint32_t read_regs = 0;
+		if (inst->src1 < reg_virtual_first) read_regs |= 1u << inst->src1;
+		if (inst->src2 < reg_virtual_first) read_regs |= 1u << inst->src2;
+		if (inst->kind == inst_kind_call || inst->kind == inst_kind_call_direct) read_regs |= pending_regs;
+
+		for (uint32_t reg = 0; reg < 32; reg++) {
+			if (!((1u << reg) & read_regs & caller_saved_regs)) continue;
+			if (!fixed_gaps[reg]) fixed_gaps[reg] = arena_push_array(&scratch_arena, size_t, cg->inst_count + 1);
+			for (size_t gap = fixed_def[reg]; gap < i; gap++) fixed_gaps[reg][gap + 1] = 1;
 		}
-		break;
+		pending_regs &= ~read_regs;
+		if (inst->dst < reg_virtual_first && ((1u << inst->dst) & caller_saved_regs)) {
+			fixed_def[inst->dst] = i;
+			pending_regs |= 1u << inst->dst;
+		}
+	}
+	for (uint32_t reg = 0; reg < 32; reg++) {
+		for (size_t i = 0; fixed_gaps[reg] && i < cg->inst_count; i++) fixed_gaps[reg][i + 1] += fixed_gaps[reg][i];
+	}
+
+	struct interval *active[32] = {0};
+	size_t active_count = 0;
+	uint32_t free_regs = caller_saved_regs | callee_saved_regs;
 
-	case node_kind_local: {
-		struct node *initializer = node_find(node, node_kind_initializer);
-		if (node_is_nil(initializer)) {
-			fprintf(file, "\tmov x9, #0\n");
+	for (uint32_t i = 0; i < cg->vreg_count; i++) {
+		struct interval *current = cg->intervals + i;
+		assert(current->start != SIZE_MAX);
+		assert(i == 0 || current->start > cg->intervals[i - 1].start);
+		current->crosses_call = calls_before[current->end] > calls_before[current->start + 1];
+
+		for (size_t j = 0; j < active_count;) {
+			if (active[j]->end <= current->start) {
+				free_regs |= 1u << active[j]->reg;
+				active[j] = active[--active_count];
+			} else {
+				j++;
+			}
+		}
+
+		uint32_t allowed = callee_saved_regs;
+		if (!current->crosses_call) allowed |= caller_saved_regs;
+		for (uint32_t reg = 0; reg < 32; reg++) {
+			if (fixed_gaps[reg] && fixed_gaps[reg][current->end] > fixed_gaps[reg][current->start]) {
+				allowed &= ~(1u << reg);
+			}
+		}
+
+		uint32_t available = free_regs & allowed;
+		if (available & caller_saved_regs) available &= caller_saved_regs;
+
+		if (available) {
+			current->reg = (uint32_t)__builtin_ctz(available);
+			free_regs &= ~(1u << current->reg);
+			active[active_count++] = current;
 		} else {
-			codegen_node(proc, initializer->first, file);
+			size_t victim = active_count;
+			for (size_t j = 0; j < active_count; j++) {
+				if (!((1u << active[j]->reg) & allowed)) continue;
+				if (victim == active_count || active[j]->end > active[victim]->end) victim = j;
+			}
+
+			if (victim != active_count && active[victim]->end > current->end) {
+				current->reg = active[victim]->reg;
+				interval_spill(cg, active[victim]);
+				active[victim] = current;
+			} else {
+				interval_spill(cg, current);
+			}
+		}
+
+		if (current->reg != reg_none && ((1u << current->reg) & callee_saved_regs)) {
+			cg->used_callee_saved |= 1u << current->reg;
 		}
-		fprintf(file, "\tstr x9, [x29, #-%zu]\n", node->local->offset);
-		break;
 	}
+}
 
-	case node_kind_assign: {
-		struct node *lhs = node->first;
-		struct node *rhs = lhs->next;
-		codegen_node_address(proc, lhs, file);
-		fprintf(file, "\tstr x9, [sp, #-16]!\n");
-		codegen_node(proc, rhs, file);
-		fprintf(file, "\tldr x10, [sp], #16\n");
-		fprintf(file, "\tstr x9, [x10]\n");
-		break;
+static void codegen_symbol(struct codegen *cg, struct entity *entity) {
+	if (!cg->target->elf) emit_char(cg->out, '_');
+	emit_str(cg->out, entity->name);
+}
+
+static struct object_symbol *codegen_object_symbol(struct object *object, struct entity *entity) {
+	if (!entity->symbol) entity->symbol = object_symbol(object, entity->name);
+	return entity->symbol;
+}
+
+static void codegen_relocate(struct codegen *cg, struct entity *entity, uint32_t type, int64_t addend) {
+	struct codegen_relocation *relocation = push_struct(struct codegen_relocation);
+	relocation->offset = cg->object->text_size;
+	relocation->entity = entity;
+	relocation->type = type;
+	relocation->addend = addend;
+	if (cg->output->first_relocation) {
+		cg->output->last_relocation->next = relocation;
+	} else {
+		cg->output->first_relocation = relocation;
+	}
+	cg->output->last_relocation = relocation;
+}
+
+static void codegen_return_label(struct codegen *cg) {
+	emit_literal(cg->out, ".L.");
+	emit_str(cg->out, cg->proc->name);
+	emit_literal(cg->out, ".return");
+}
+
+static void codegen_proc(struct codegen *cg, struct ir_proc *ir_proc) {
+	cg->proc = ir_proc->entity;
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+
+	codegen_lower(cg, ir_proc);
+	regalloc(cg);
+
+	bool x64 = cg->target->arch == target_arch_x86_64;
+	if (!cg->object) {
+		emit_literal(cg->out, ".global ");
+		codegen_symbol(cg, cg->proc);
+		if (cg->target->elf) {
+			emit_literal(cg->out, "\n.type ");
+			codegen_symbol(cg, cg->proc);
+			emit_literal(cg->out, ", %function");
+		}
+		if (x64) {
+			emit_literal(cg->out, "\n.p2align 4, 0xcc\n");
+		} else {
+			emit_literal(cg->out, "\n.align 2\n");
+		}
+		codegen_symbol(cg, cg->proc);
+		emit_literal(cg->out, ":\n");
 	}
 
-	case node_kind_expr_stmt: {
-		struct node *expr = node->first;
-		codegen_node(proc, expr, file);
+	switch (cg->target->arch) {
+	case target_arch_aarch64:
+		a64_proc(cg);
+		break;
+	case target_arch_x86_64:
+		x64_proc(cg);
 		break;
 	}
 
-	case node_kind_return: {
-		struct node *return_value = node->first;
-		if (!node_is_nil(return_value)) {
-			codegen_node(proc, return_value, file);
-			fprintf(file, "\tmov x0, x9\n");
+	if (!cg->object && cg->target->elf) {
+		emit_literal(cg->out, ".size ");
+		codegen_symbol(cg, cg->proc);
+		emit_literal(cg->out, ", .-");
+		codegen_symbol(cg, cg->proc);
+		emit_char(cg->out, '\n');
+	}
+
+	arena_reset(&scratch_arena, scratch_mark);
+}
+
+// Places a procedure’s code at the end of the object and resolves its references.
+// Symbols are created in the order a serial pass would create them, so the object does not depend on scheduling.
+static void codegen_place(struct object *object, const struct target *target, struct entity *proc,
+        struct codegen_output *output) {
+	// x86-64 procedures start on 16-byte boundaries, padded with int3.
+	while (target->arch == target_arch_x86_64 && object->text_size % 16 != 0) object_bytes(object, "\xcc", 1);
+	size_t start = object->text_size;
+	object_define(object, codegen_object_symbol(object, proc));
+	object_bytes(object, output->object.text, output->object.text_size);
+	proc->symbol->size = output->object.text_size;
+
+	for (struct codegen_relocation *relocation = output->first_relocation; relocation;
+	        relocation = relocation->next) {
+		struct object_symbol *symbol = codegen_object_symbol(object, relocation->entity);
+		object_relocate(object, start + relocation->offset, symbol, relocation->type, relocation->addend);
+	}
+	free(output->object.text);
+}
+
+// Cached object code names the procedures it refers to, so loading it looks entities up by name.
+struct codegen_entity_table {
+	struct entity **entities;
+	size_t capacity;
+};
+
+static struct entity **codegen_entity_slot(struct codegen_entity_table *table, const char *name, size_t length) {
+	size_t mask = table->capacity - 1;
+	size_t i = hash_bytes(name, length) & mask;
+	while (table->entities[i]) {
+		char *other = table->entities[i]->name;
+		if (strncmp(other, name, length) == 0 && other[length] == 0) break;
+		i = (i + 1) & mask;
+	}
+	return table->entities + i;
+}
+
+static void codegen_output_save(struct codegen_output *output, bool emit_object, struct emitter *e) {
+	if (!emit_object) {
+		emit_flush_chunk(&output->out);
+		for (struct emit_chunk *chunk = output->out.first; chunk; chunk = chunk->next) {
+			emit_bytes(e, chunk->data, chunk->length);
 		}
-		fprintf(file, "\tb .L.%s.return\n", proc->name);
-		break;
+		return;
 	}
 
-	case node_kind_block:
-		for (struct node *kid = node->first; !node_is_nil(kid); kid = kid->next) {
-			codegen_node(proc, kid, file);
+	uint64_t text_size = output->object.text_size;
+	emit_bytes(e, (char *)&text_size, sizeof(text_size));
+	emit_bytes(e, (char *)output->object.text, text_size);
+	for (struct codegen_relocation *relocation = output->first_relocation; relocation;
+	        relocation = relocation->next) {
+		uint64_t offset = relocation->offset;
+		uint64_t name_length = strlen(relocation->entity->name);
+		emit_bytes(e, (char *)&offset, sizeof(offset));
+		emit_bytes(e, (char *)&relocation->type, sizeof(relocation->type));
+		emit_bytes(e, (char *)&relocation->addend, sizeof(relocation->addend));
+		emit_bytes(e, (char *)&name_length, sizeof(name_length));
+		emit_bytes(e, relocation->entity->name, name_length);
+	}
+}
+
+// Fails if the entry is malformed or refers to a procedure that no longer exists.
+static bool codegen_output_load(struct codegen_output *output, bool emit_object, struct cache_reader *reader,
+        struct codegen_entity_table *entities) {
+	if (!emit_object) {
+		emit_bytes(&output->out, (char *)reader->at, (size_t)(reader->end - reader->at));
+		return true;
+	}
+
+	uint64_t text_size = 0;
+	if (!cache_read(reader, &text_size, sizeof(text_size))) return false;
+	if ((uint64_t)(reader->end - reader->at) < text_size) return false;
+	object_bytes(&output->object, reader->at, text_size);
+	reader->at += text_size;
+
+	while (reader->at != reader->end) {
+		uint64_t offset = 0;
+		uint32_t type = 0;
+		int64_t addend = 0;
+		uint64_t name_length = 0;
+		if (!cache_read(reader, &offset, sizeof(offset)) || !cache_read(reader, &type, sizeof(type)) ||
+		        !cache_read(reader, &addend, sizeof(addend)) ||
+		        !cache_read(reader, &name_length, sizeof(name_length))) {
+			return false;
 		}
-		break;
+		if ((uint64_t)(reader->end - reader->at) < name_length || offset >= text_size) return false;
+		struct entity *entity = *codegen_entity_slot(entities, (char *)reader->at, name_length);
+		reader->at += name_length;
+		if (!entity) return false;
 
-	case node_kind_nil:
-	case node_kind_root:
-	case node_kind_proc:
-	case node_kind_proc_type:
-	case node_kind_param:
-	case node_kind_params:
-	case node_kind_initializer:
-	case node_kind_type:
-	case node_kind__last:
-		unreachable();
+		struct codegen_relocation *relocation = push_struct(struct codegen_relocation);
+		relocation->offset = offset;
+		relocation->entity = entity;
+		relocation->type = type;
+		relocation->addend = addend;
+		if (output->first_relocation) {
+			output->last_relocation->next = relocation;
+		} else {
+			output->first_relocation = relocation;
+		}
+		output->last_relocation = relocation;
 	}
+	return true;
 }
 
-static void codegen_node_address(struct entity *proc, struct node *node, FILE *file) {
-	switch (node->kind) {
-	case node_kind_name:
-		if (node->local) {
-			fprintf(file, "\tsub x9, x29, #%zu\n", node->local->offset);
+// Like checking, only the error of the earliest failing procedure is reported.
+struct codegen_pass {
+	const struct target *target;
+	bool emit_object;
+	struct entity **procs;
+	struct codegen_output *outputs;
+	struct codegen_entity_table entities;
+
+	pthread_mutex_t lock;
+	atomic_size_t first_error;
+	char *error_path;
+	size_t error_line;
+	char *error_message;
+};
+
+static void codegen_job(void *context, size_t index) {
+	struct codegen_pass *pass = context;
+	if (index > atomic_load(&pass->first_error)) return;
+
+	struct entity *proc = pass->procs[index];
+	struct codegen_output *output = pass->outputs + index;
+	error_path = proc->unit->name;
+
+	struct error_trap *outer_trap = error_trap;
+	struct error_trap trap = {0};
+	if (setjmp(trap.jump)) {
+		error_trap = outer_trap;
+		pthread_mutex_lock(&pass->lock);
+		if (index < atomic_load(&pass->first_error)) {
+			free(pass->error_message);
+			pass->error_path = trap.path;
+			pass->error_line = trap.line;
+			pass->error_message = trap.message;
+			atomic_store(&pass->first_error, index);
 		} else {
-			error(node->line, "cannot take address of procedure");
+			free(trap.message);
 		}
-		break;
+		pthread_mutex_unlock(&pass->lock);
+		return;
+	}
+	error_trap = &trap;
 
-	case node_kind_deref:
-		codegen_node(proc, node->first, file);
-		break;
+	struct cache_key key = {0};
+	if (cache_directory) {
+		struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+		key = cache_key(proc, pass->target->name, pass->emit_object);
+		// Inlining is only reported while building IR, which cached code skips.
+		struct cache_reader reader = inline_report ? (struct cache_reader){0} : cache_load(key);
+		bool hit = reader.at && codegen_output_load(output, pass->emit_object, &reader, &pass->entities);
+		arena_reset(&scratch_arena, scratch_mark);
+		if (hit) {
+			atomic_fetch_add(&cache_hits, 1);
+			error_trap = outer_trap;
+			return;
+		}
+		atomic_fetch_add(&cache_misses, 1);
+		free(output->object.text);
+		*output = (struct codegen_output){0};
+	}
+
+	struct ir_proc *ir_proc = ir_build_proc(proc);
+	ir_fold_proc(ir_proc);
+	output->first_decision = ir_proc->first_decision;
+	struct codegen cg = {.target = pass->target, .output = output, .out = &output->out};
+	if (pass->emit_object) cg.object = &output->object;
+	codegen_proc(&cg, ir_proc);
 
-	default:
-		error(node->line, "expression doesn’t have an address");
+	if (cache_directory) {
+		struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+		struct emitter entry = {0};
+		codegen_output_save(output, pass->emit_object, &entry);
+		cache_store(key, &entry);
+		arena_reset(&scratch_arena, scratch_mark);
 	}
+	error_trap = outer_trap;
 }
 
-static size_t round_up(size_t n, size_t m) {
-	size_t remainder = n % m;
-	if (remainder == 0) return n;
-	size_t result = n + m - remainder;
-	assert(result % m == 0);
-	assert(result > n);
-	return result;
-}
+// Generates the procedures of every stale unit in parallel, then lays each unit’s out in source order.
+static void codegen(struct unit *first_unit, struct entity *first_entity, const struct target *target, bool emit_object) {
+	assert(!emit_object || target->elf);
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
 
-static void codegen(struct entity *first_entity, FILE *file) {
-	for (struct entity *proc = first_entity; proc; proc = proc->next) {
-		assert(proc->kind == entity_kind_proc);
-		fprintf(file, ".global _%s\n", proc->name);
-		fprintf(file, ".align 2\n");
-		fprintf(file, "_%s:\n", proc->name);
+	size_t entity_count = 0;
+	size_t proc_count = 0;
+	for (struct entity *entity = first_entity; entity; entity = entity->next) {
+		entity_count++;
+		if (entity->unit->stale) proc_count++;
+	}
 
-		size_t locals_size = round_up(proc->locals_size, 16);
-		fprintf(file, "\tstp x29, x30, [sp, #-16]!\n");
-		fprintf(file, "\tmov x29, sp\n");
-		fprintf(file, "\tsub sp, sp, #%zu\n", locals_size);
+	struct codegen_pass pass = {.target = target, .emit_object = emit_object};
+	pass.procs = arena_push_array(&scratch_arena, struct entity *, proc_count);
+	pass.outputs = arena_push_array(&scratch_arena, struct codegen_output, proc_count);
+	size_t i = 0;
+	for (struct entity *entity = first_entity; entity; entity = entity->next) {
+		if (entity->unit->stale) pass.procs[i++] = entity;
+	}
 
-		size_t reg = 0;
-		for (struct param *param = proc->first_param; param; param = param->next) {
-			fprintf(file, "\tstr x%zu, [x29, #-%zu]\n", reg, param->local->offset);
-			reg++;
+	if (cache_directory) {
+		pass.entities.capacity = 16;
+		while (pass.entities.capacity < 2 * entity_count) pass.entities.capacity *= 2;
+		pass.entities.entities = arena_push_array(&scratch_arena, struct entity *, pass.entities.capacity);
+		for (struct entity *entity = first_entity; entity; entity = entity->next) {
+			*codegen_entity_slot(&pass.entities, entity->name, strlen(entity->name)) = entity;
 		}
+	}
+
+	pass.first_error = proc_count;
+	pthread_mutex_init(&pass.lock, 0);
+	pool_for(proc_count, codegen_job, &pass);
+	pthread_mutex_destroy(&pass.lock);
+	if (pass.first_error < proc_count) {
+		for (i = 0; i < proc_count; i++) free(pass.outputs[i].object.text);
+		arena_reset(&scratch_arena, scratch_mark);
+		struct error_trap error = {.path = pass.error_path, .line = pass.error_line, .message = pass.error_message};
+		error_raise(&error);
+	}
 
-		codegen_node(proc, proc->body, file);
+	for (i = 0; inline_report && i < proc_count; i++) {
+		ir_report_inlining(pass.procs[i], pass.outputs[i].first_decision, inline_report);
+	}
+
+	i = 0;
+	for (struct unit *unit = first_unit; unit; unit = unit->next) {
+		if (!unit->stale) continue;
+		unit->out = push_struct(struct emitter);
+		size_t end = i;
+		while (end < proc_count && pass.procs[end]->unit == unit) end++;
 
-		fprintf(file, ".L.%s.return:\n", proc->name);
-		fprintf(file, "\tadd sp, sp, #%zu\n", locals_size);
-		fprintf(file, "\tldp x29, x30, [sp], #16\n");
-		fprintf(file, "\tret\n");
+		if (emit_object) {
+			// Symbols belong to one object, so entities may still hold those of the previous unit.
+			for (size_t j = i; j < end; j++) {
+				pass.procs[j]->symbol = 0;
+				for (struct codegen_relocation *relocation = pass.outputs[j].first_relocation; relocation;
+				        relocation = relocation->next) {
+					relocation->entity->symbol = 0;
+				}
+			}
+			struct object object = {.machine = target->elf_machine};
+			for (; i < end; i++) codegen_place(&object, target, pass.procs[i], pass.outputs + i);
+			object_write(&object, unit->out);
+		} else {
+			for (; i < end; i++) emit_append(unit->out, &pass.outputs[i].out);
+			if (target->elf) emit_literal(unit->out, ".section .note.GNU-stack,\"\",%progbits\n");
+		}
 	}
+
+	arena_reset(&scratch_arena, scratch_mark);
 }
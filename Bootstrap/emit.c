@@ -0,0 +1,132 @@
+struct emit_chunk {
+	struct emit_chunk *next;
+	char *data;
+	size_t length;
+};
+
+struct emitter {
+	struct emit_chunk *first;
+	struct emit_chunk *last;
+	char *cursor;
+	char *end;
+};
+
+// Chunks start small, since every procedure is generated into an emitter of its own,
+// and double up to emit_chunk_size.
+static const size_t emit_first_chunk_size = 1024;
+static const size_t emit_chunk_size = 1024 * 1024;
+
+#define emit_literal(e, s) emit_bytes((e), (s), sizeof(s) - 1)
+
+static void emit_flush_chunk(struct emitter *e) {
+	if (e->last) e->last->length = (size_t)(e->cursor - e->last->data);
+}
+
+static void emit_grow(struct emitter *e, size_t size) {
+	emit_flush_chunk(e);
+
+	size_t capacity = emit_first_chunk_size;
+	if (e->last) capacity = 2 * (size_t)(e->end - e->last->data);
+	if (capacity > emit_chunk_size) capacity = emit_chunk_size;
+	if (capacity < size) capacity = size;
+	struct emit_chunk *chunk = push_struct(struct emit_chunk);
+	chunk->data = push_array(char, capacity);
+
+	if (e->first) {
+		e->last->next = chunk;
+	} else {
+		e->first = chunk;
+	}
+	e->last = chunk;
+	e->cursor = chunk->data;
+	e->end = chunk->data + capacity;
+}
+
+// Moves the contents of part to the end of e without copying, leaving part empty.
+static void emit_append(struct emitter *e, struct emitter *part) {
+	if (!part->first) return;
+	emit_flush_chunk(e);
+	emit_flush_chunk(part);
+	if (e->first) {
+		e->last->next = part->first;
+	} else {
+		e->first = part->first;
+	}
+	e->last = part->last;
+	e->cursor = part->cursor;
+	e->end = part->end;
+	*part = (struct emitter){0};
+}
+
+static void emit_bytes(struct emitter *e, const char *bytes, size_t size) {
+	if ((size_t)(e->end - e->cursor) < size) emit_grow(e, size);
+	memcpy(e->cursor, bytes, size);
+	e->cursor += size;
+}
+
+static void emit_char(struct emitter *e, char c) {
+	if (e->cursor == e->end) emit_grow(e, 1);
+	*e->cursor++ = c;
+}
+
+static void emit_str(struct emitter *e, const char *s) {
+	emit_bytes(e, s, strlen(s));
+}
+
+static void emit_u64(struct emitter *e, uint64_t value) {
+	char digits[20];
+	size_t count = 0;
+	do {
+		digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+	emit_bytes(e, digits + sizeof(digits) - count, count);
+}
+
+static void emit_i64(struct emitter *e, int64_t value) {
+	if (value < 0) {
+		emit_char(e, '-');
+		emit_u64(e, -(uint64_t)value);
+	} else {
+		emit_u64(e, (uint64_t)value);
+	}
+}
+
+static void emit_write(struct emitter *e, char *path) {
+	emit_flush_chunk(e);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) io_error(path, "open");
+
+	struct emit_chunk *chunk = e->first;
+	size_t chunk_offset = 0;
+	while (chunk) {
+		struct iovec iov[64];
+		int iov_count = 0;
+		for (struct emit_chunk *c = chunk; c && iov_count < (int)countof(iov); c = c->next) {
+			size_t skip = c == chunk ? chunk_offset : 0;
+			iov[iov_count].iov_base = c->data + skip;
+			iov[iov_count].iov_len = c->length - skip;
+			iov_count++;
+		}
+
+		ssize_t written = writev(fd, iov, iov_count);
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			int write_errno = errno;
+			close(fd);
+			errno = write_errno;
+			io_error(path, "write");
+		}
+
+		size_t remaining = (size_t)written;
+		while (chunk && remaining >= chunk->length - chunk_offset) {
+			remaining -= chunk->length - chunk_offset;
+			chunk = chunk->next;
+			chunk_offset = 0;
+		}
+		chunk_offset += remaining;
+	}
+
+	if (close(fd) != 0) io_error(path, "write");
+}
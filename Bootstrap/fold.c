@@ -0,0 +1,147 @@
+static struct ir_inst *fold_resolve(struct ir_inst *value) {
+	while (value && value->replacement) value = value->replacement;
+	return value;
+}
+
+static bool fold_is_const(struct ir_inst *value, uint64_t constant) {
+	return value->op == ir_op_const && value->imm == constant;
+}
+
+static void fold_to_const(struct ir_inst *inst, uint64_t value) {
+	inst->op = ir_op_const;
+	inst->imm = value;
+	inst->a = 0;
+	inst->b = 0;
+}
+
+static void fold_binary(struct ir_inst *inst) {
+	struct ir_inst *lhs = inst->a;
+	struct ir_inst *rhs = inst->b;
+
+	if (lhs->op == ir_op_const && rhs->op == ir_op_const) {
+		uint64_t x = lhs->imm;
+		uint64_t y = rhs->imm;
+		switch (inst->op) {
+		case ir_op_add:
+			fold_to_const(inst, x + y);
+			break;
+		case ir_op_sub:
+			fold_to_const(inst, x - y);
+			break;
+		case ir_op_mul:
+			fold_to_const(inst, x * y);
+			break;
+		case ir_op_div:
+			// Division by zero and INT64_MIN / -1 are left for the target to define.
+			if (y == 0 || (x == (uint64_t)INT64_MIN && y == UINT64_MAX)) break;
+			fold_to_const(inst, (uint64_t)((int64_t)x / (int64_t)y));
+			break;
+		default:
+			unreachable();
+		}
+		return;
+	}
+
+	switch (inst->op) {
+	case ir_op_add:
+		if (fold_is_const(lhs, 0)) inst->replacement = rhs;
+		if (fold_is_const(rhs, 0)) inst->replacement = lhs;
+		break;
+	case ir_op_sub:
+		if (fold_is_const(rhs, 0)) inst->replacement = lhs;
+		break;
+	case ir_op_mul:
+		if (fold_is_const(lhs, 1)) inst->replacement = rhs;
+		if (fold_is_const(rhs, 1)) inst->replacement = lhs;
+		if (fold_is_const(lhs, 0) || fold_is_const(rhs, 0)) fold_to_const(inst, 0);
+		break;
+	case ir_op_div:
+		if (fold_is_const(rhs, 1)) inst->replacement = lhs;
+		break;
+	default:
+		unreachable();
+	}
+}
+
+static void fold_inst(struct ir_inst *inst) {
+	inst->a = fold_resolve(inst->a);
+	inst->b = fold_resolve(inst->b);
+	for (size_t i = 0; i < inst->arg_count; i++) {
+		inst->args[i] = fold_resolve(inst->args[i]);
+	}
+
+	switch (inst->op) {
+	case ir_op_add:
+	case ir_op_sub:
+	case ir_op_mul:
+	case ir_op_div:
+		fold_binary(inst);
+		break;
+	default:
+		break;
+	}
+}
+
+// Removes instructions without side effects whose values are never used.
+// Walking backwards visits every use of a value before its definition.
+static void fold_remove_dead(struct ir_proc *proc) {
+	size_t count = 0;
+	for (struct ir_block *block = proc->first_block; block; block = block->next) {
+		for (struct ir_inst *inst = block->first; inst; inst = inst->next) count++;
+	}
+
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+	struct ir_inst **insts = arena_push_array(&scratch_arena, struct ir_inst *, count);
+	bool *live = arena_push_array(&scratch_arena, bool, count);
+	uint32_t *uses = arena_push_array(&scratch_arena, uint32_t, proc->value_count);
+	count = 0;
+	for (struct ir_block *block = proc->first_block; block; block = block->next) {
+		for (struct ir_inst *inst = block->first; inst; inst = inst->next) insts[count++] = inst;
+	}
+
+	for (size_t i = count; i > 0; i--) {
+		struct ir_inst *inst = insts[i - 1];
+		live[i - 1] = ir_has_side_effects(inst) || uses[inst->id] > 0;
+		if (!live[i - 1]) continue;
+		if (inst->a) uses[inst->a->id]++;
+		if (inst->b) uses[inst->b->id]++;
+		for (size_t j = 0; j < inst->arg_count; j++) {
+			uses[inst->args[j]->id]++;
+		}
+	}
+
+	size_t i = 0;
+	for (struct ir_block *block = proc->first_block; block; block = block->next) {
+		struct ir_inst *first = 0;
+		struct ir_inst *last = 0;
+		for (struct ir_inst *inst = block->first; inst; inst = inst->next, i++) {
+			if (!live[i]) continue;
+			if (first) {
+				last->next = inst;
+			} else {
+				first = inst;
+			}
+			last = inst;
+		}
+		if (last) last->next = 0;
+		block->first = first;
+		block->last = last;
+	}
+
+	arena_reset(&scratch_arena, scratch_mark);
+}
+
+// Folds arithmetic on constants and simplifies x + 0, x - 0, x * 1, x * 0 and x / 1.
+// Promoted locals are SSA values, so folding sees through locals holding constants.
+static void ir_fold_proc(struct ir_proc *proc) {
+	for (struct ir_block *block = proc->first_block; block; block = block->next) {
+		for (struct ir_inst *inst = block->first; inst; inst = inst->next) {
+			fold_inst(inst);
+		}
+	}
+	fold_remove_dead(proc);
+}
+
+static void ir_fold(struct ir_proc *first_proc) {
+	for (struct ir_proc *proc = first_proc; proc; proc = proc->next) ir_fold_proc(proc);
+}
@@ -0,0 +1,59 @@
+// Every distinct identifier is stored once, so names can be compared by pointer.
+struct intern_entry {
+	char *string;
+	size_t length;
+	uint64_t hash;
+};
+
+static struct intern_entry *intern_table;
+static size_t intern_table_capacity;
+static size_t intern_table_count;
+
+static struct intern_entry *intern_find(const char *s, size_t length, uint64_t hash) {
+	size_t mask = intern_table_capacity - 1;
+	size_t i = hash & mask;
+	while (intern_table[i].string) {
+		struct intern_entry *entry = intern_table + i;
+		if (entry->hash == hash && entry->length == length && memcmp(entry->string, s, length) == 0) break;
+		i = (i + 1) & mask;
+	}
+	return intern_table + i;
+}
+
+static void intern_table_grow(void) {
+	struct intern_entry *old_table = intern_table;
+	size_t old_capacity = intern_table_capacity;
+
+	intern_table_capacity = old_capacity == 0 ? 1024 : 2 * old_capacity;
+	intern_table = push_array(struct intern_entry, intern_table_capacity);
+	for (size_t i = 0; i < old_capacity; i++) {
+		struct intern_entry *entry = old_table + i;
+		if (entry->string) *intern_find(entry->string, entry->length, entry->hash) = *entry;
+	}
+}
+
+static char *intern(const char *s, size_t length) {
+	if (4 * (intern_table_count + 1) > 3 * intern_table_capacity) intern_table_grow();
+
+	uint64_t hash = hash_bytes(s, length);
+	struct intern_entry *entry = intern_find(s, length, hash);
+	if (!entry->string) {
+		char *string = push_array(char, length + 1);
+		memcpy(string, s, length);
+		entry->string = string;
+		entry->length = length;
+		entry->hash = hash;
+		intern_table_count++;
+	}
+	return entry->string;
+}
+
+static void intern_reset(void) {
+	intern_table = 0;
+	intern_table_capacity = 0;
+	intern_table_count = 0;
+}
+
+static char *intern_cstring(const char *s) {
+	return intern(s, strlen(s));
+}
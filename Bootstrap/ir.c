@@ -0,0 +1,456 @@
+static bool ir_has_side_effects(struct ir_inst *inst) {
+	return inst->op == ir_op_store || inst->op == ir_op_call || inst->op == ir_op_ret;
+}
+
+// Direct calls to small procedures of the same unit are replaced by the callee’s body while building,
+// so arguments flow straight into its arithmetic and the call, frame and spills disappear.
+// A callee qualifies when its body is at most inline_size_limit nodes, plus inline_constant_bonus
+// for every constant argument, since those usually fold away once substituted.
+// Callees with locals in memory are left alone, as their slots would have to move into the caller’s frame.
+static const uint32_t inline_size_limit = 12;
+static const uint32_t inline_constant_bonus = 4;
+static const uint32_t inline_depth_limit = 3;
+// How many nodes a procedure may take in from its callees, which bounds its growth.
+static const uint32_t inline_growth_limit = 96;
+
+// Where --inline-report goes, or null.
+static FILE *inline_report;
+
+// A callee body being built in place of a call. Its locals are copied,
+// because the originals are shared with whoever builds the callee itself.
+struct ir_inline {
+	struct ir_inline *up;
+	struct entity *callee;
+	struct local **locals;
+	struct local **copies;
+	size_t local_count;
+	struct ir_inst *result;
+	bool returned;
+};
+
+struct ir_builder {
+	struct ir_proc *proc;
+	struct ir_block *block;
+	struct ir_inline *inline_frame;
+	uint32_t inline_depth;
+	uint32_t inlined_size;
+};
+
+static void ir_block_start(struct ir_builder *b) {
+	struct ir_block *block = push_struct(struct ir_block);
+	block->id = b->proc->block_count++;
+	if (b->proc->first_block) {
+		b->proc->last_block->next = block;
+	} else {
+		b->proc->first_block = block;
+	}
+	b->proc->last_block = block;
+	b->block = block;
+}
+
+static struct ir_inst *ir_emit(struct ir_builder *b, enum ir_op op, bool has_value) {
+	struct ir_inst *inst = push_struct(struct ir_inst);
+	inst->op = op;
+	inst->has_value = has_value;
+	if (has_value) inst->id = b->proc->value_count++;
+
+	if (b->block->last && b->block->last->op == ir_op_ret) ir_block_start(b);
+	if (b->block->first) {
+		b->block->last->next = inst;
+	} else {
+		b->block->first = inst;
+	}
+	b->block->last = inst;
+	return inst;
+}
+
+static struct ir_inst *ir_emit_binary(struct ir_builder *b, enum ir_op op, struct ir_inst *lhs, struct ir_inst *rhs) {
+	struct ir_inst *inst = ir_emit(b, op, true);
+	inst->a = lhs;
+	inst->b = rhs;
+	return inst;
+}
+
+static struct ir_inst *ir_emit_local(struct ir_builder *b, struct local *local) {
+	assert(local->address_taken);
+	struct ir_inst *inst = ir_emit(b, ir_op_local, true);
+	inst->local = local;
+	return inst;
+}
+
+static struct ir_inst *ir_emit_const(struct ir_builder *b, uint64_t value) {
+	struct ir_inst *inst = ir_emit(b, ir_op_const, true);
+	inst->imm = value;
+	return inst;
+}
+
+static void ir_emit_store(struct ir_builder *b, struct ir_inst *address, struct ir_inst *value) {
+	struct ir_inst *inst = ir_emit(b, ir_op_store, false);
+	inst->a = address;
+	inst->b = value;
+}
+
+// Locals whose address is never taken are kept in SSA form as they are built:
+// procedures have no control flow, so every read sees the value of the latest definition.
+static void ir_define_local(struct ir_builder *b, struct local *local, struct ir_inst *value) {
+	if (local->address_taken) {
+		ir_emit_store(b, ir_emit_local(b, local), value);
+	} else {
+		local->value = value;
+	}
+}
+
+// The local a node refers to, or its copy inside an inlined body.
+static struct local *ir_local(struct ir_builder *b, struct local *local) {
+	struct ir_inline *frame = b->inline_frame;
+	if (!local || !frame) return local;
+	for (size_t i = 0; i < frame->local_count; i++) {
+		if (frame->locals[i] == local) return frame->copies[i];
+	}
+	unreachable();
+}
+
+static struct local *ir_node_local(struct ir_builder *b, uint32_t node) {
+	return ir_local(b, node_local(node));
+}
+
+static struct ir_inst *ir_build_address(struct ir_builder *b, uint32_t node);
+static void ir_build_stmt(struct ir_builder *b, uint32_t node);
+
+// Whether the code of proc can include callee’s body, as far as the callee alone decides.
+// Cache keys use this to cover the bodies a procedure’s code may be built from.
+static bool ir_has_locals_in_memory(struct entity *proc) {
+	for (struct local *local = proc->first_local; local; local = local->next) {
+		if (local->address_taken) return true;
+	}
+	return false;
+}
+
+static bool ir_can_inline(struct entity *proc, struct entity *callee) {
+	uint32_t limit = inline_size_limit + inline_constant_bonus * (uint32_t)callee->param_count;
+	return callee->unit == proc->unit && callee->body_size <= limit && !ir_has_locals_in_memory(callee);
+}
+
+// Returns why the call should not be inlined, or null if it should.
+static char *ir_inline_refusal(struct ir_builder *b, struct entity *callee, struct ir_inst **args, size_t arg_count) {
+	struct entity *proc = b->proc->entity;
+	if (callee == proc) return "recursive";
+	for (struct ir_inline *frame = b->inline_frame; frame; frame = frame->up) {
+		if (frame->callee == callee) return "recursive";
+	}
+	if (callee->unit != proc->unit) return "in another unit";
+	if (ir_has_locals_in_memory(callee)) return "has locals in memory";
+
+	uint32_t limit = inline_size_limit;
+	for (size_t i = 0; i < arg_count; i++) {
+		if (args[i]->op == ir_op_const) limit += inline_constant_bonus;
+	}
+	if (callee->body_size > limit) return "too large";
+	if (b->inline_depth == inline_depth_limit) return "nested too deeply";
+	if (b->inlined_size + callee->body_size > inline_growth_limit) return "caller grew too large";
+	return 0;
+}
+
+static void ir_record_decision(struct ir_builder *b, uint32_t call, struct entity *callee, char *reason) {
+	if (!inline_report) return;
+	struct ir_inline_decision *decision = push_struct(struct ir_inline_decision);
+	decision->line = node_line(call);
+	decision->callee = callee;
+	decision->size = callee->body_size;
+	decision->reason = reason;
+	if (b->proc->first_decision) {
+		b->proc->last_decision->next = decision;
+	} else {
+		b->proc->first_decision = decision;
+	}
+	b->proc->last_decision = decision;
+}
+
+// Builds the callee’s statements up to the first return it reaches, whose value stands for the call.
+// Without branches in the language, nothing after that return can run.
+static struct ir_inst *ir_build_inline(struct ir_builder *b, struct entity *callee, struct ir_inst **args) {
+	struct ir_inline frame = {.up = b->inline_frame, .callee = callee};
+	for (struct local *local = callee->first_local; local; local = local->next) frame.local_count++;
+	frame.locals = push_array(struct local *, frame.local_count);
+	frame.copies = push_array(struct local *, frame.local_count);
+	size_t i = 0;
+	for (struct local *local = callee->first_local; local; local = local->next, i++) {
+		frame.locals[i] = local;
+		frame.copies[i] = push_struct(struct local);
+		frame.copies[i]->name = local->name;
+		frame.copies[i]->type = local->type;
+	}
+
+	b->inline_frame = &frame;
+	b->inline_depth++;
+	b->inlined_size += callee->body_size;
+	i = 0;
+	for (struct param *param = callee->first_param; param; param = param->next) {
+		ir_local(b, param->local)->value = args[i++];
+	}
+	ir_build_stmt(b, callee->body);
+	b->inline_depth--;
+	b->inline_frame = frame.up;
+
+	// Falling off the end of a procedure that returns a value leaves it undefined; zero will do.
+	if (!frame.result && callee->type->inner) {
+		frame.result = ir_emit_const(b, 0);
+	}
+	return frame.result;
+}
+
+static struct ir_inst *ir_build_expr(struct ir_builder *b, uint32_t node) {
+	struct ir_inst *result = 0;
+
+	switch (node_kind(node)) {
+	case node_kind_name: {
+		struct local *local = ir_node_local(b, node);
+		if (local && local->address_taken) {
+			struct ir_inst *address = ir_emit_local(b, local);
+			result = ir_emit(b, ir_op_load, true);
+			result->a = address;
+		} else if (local) {
+			result = local->value;
+		} else {
+			result = ir_emit(b, ir_op_proc, true);
+			result->entity = node_entity(node);
+		}
+		break;
+	}
+
+	case node_kind_number:
+		result = ir_emit_const(b, ast.data[node].value);
+		break;
+
+	case node_kind_address:
+		result = ir_build_address(b, node_a(node));
+		break;
+
+	case node_kind_deref: {
+		struct ir_inst *address = ir_build_expr(b, node_a(node));
+		result = ir_emit(b, ir_op_load, true);
+		result->a = address;
+		break;
+	}
+
+	case node_kind_call: {
+		struct node_list list = node_list(node);
+		size_t arg_count = list.count - 1;
+		struct ir_inst **args = push_array(struct ir_inst *, arg_count);
+		for (uint32_t i = 1; i < list.count; i++) {
+			args[i - 1] = ir_build_expr(b, list.nodes[i]);
+		}
+
+		struct entity *entity = node_entity(list.nodes[0]);
+		if (entity) {
+			char *refusal = ir_inline_refusal(b, entity, args, arg_count);
+			ir_record_decision(b, node, entity, refusal);
+			if (!refusal) {
+				result = ir_build_inline(b, entity, args);
+				break;
+			}
+		}
+
+		struct ir_inst *callee = ir_build_expr(b, list.nodes[0]);
+		result = ir_emit(b, ir_op_call, ast.types[node] != 0);
+		result->a = callee;
+		result->args = args;
+		result->arg_count = arg_count;
+		break;
+	}
+
+	case node_kind_add:
+	case node_kind_sub:
+	case node_kind_mul:
+	case node_kind_div: {
+		static const enum ir_op ops[node_kind__last] = {
+		        [node_kind_add] = ir_op_add,
+		        [node_kind_sub] = ir_op_sub,
+		        [node_kind_mul] = ir_op_mul,
+		        [node_kind_div] = ir_op_div,
+		};
+		struct ir_inst *lhs = ir_build_expr(b, node_a(node));
+		struct ir_inst *rhs = ir_build_expr(b, node_b(node));
+		result = ir_emit_binary(b, ops[node_kind(node)], lhs, rhs);
+		break;
+	}
+
+	default:
+		unreachable();
+	}
+
+	return result;
+}
+
+static struct ir_inst *ir_build_address(struct ir_builder *b, uint32_t node) {
+	switch (node_kind(node)) {
+	case node_kind_name:
+		assert(node_local(node));
+		return ir_emit_local(b, ir_node_local(b, node));
+
+	default:
+		assert(node_kind(node) == node_kind_deref);
+		return ir_build_expr(b, node_a(node));
+	}
+}
+
+static void ir_build_stmt(struct ir_builder *b, uint32_t node) {
+	if (b->inline_frame && b->inline_frame->returned) return;
+
+	switch (node_kind(node)) {
+	case node_kind_local: {
+		uint32_t initializer = node_b(node);
+		struct ir_inst *value = 0;
+		if (node_is_nil(initializer)) {
+			value = ir_emit_const(b, 0);
+		} else {
+			value = ir_build_expr(b, node_a(initializer));
+		}
+		ir_define_local(b, ir_node_local(b, node), value);
+		break;
+	}
+
+	case node_kind_assign: {
+		uint32_t lhs = node_a(node);
+		uint32_t rhs = node_b(node);
+		struct local *local = ir_node_local(b, lhs);
+		if (node_kind(lhs) == node_kind_name && local && !local->address_taken) {
+			local->value = ir_build_expr(b, rhs);
+		} else {
+			struct ir_inst *address = ir_build_address(b, lhs);
+			ir_emit_store(b, address, ir_build_expr(b, rhs));
+		}
+		break;
+	}
+
+	case node_kind_expr_stmt:
+		ir_build_expr(b, node_a(node));
+		break;
+
+	case node_kind_return: {
+		uint32_t return_value = node_a(node);
+		struct ir_inst *value = 0;
+		if (!node_is_nil(return_value)) value = ir_build_expr(b, return_value);
+		if (b->inline_frame) {
+			b->inline_frame->result = value;
+			b->inline_frame->returned = true;
+		} else {
+			ir_emit(b, ir_op_ret, false)->a = value;
+		}
+		break;
+	}
+
+	case node_kind_block: {
+		struct node_list list = node_list(node);
+		for (uint32_t i = 0; i < list.count; i++) {
+			ir_build_stmt(b, list.nodes[i]);
+		}
+		break;
+	}
+
+	default:
+		unreachable();
+	}
+}
+
+static struct ir_proc *ir_build_proc(struct entity *entity) {
+	struct ir_builder b = {0};
+	b.proc = push_struct(struct ir_proc);
+	b.proc->entity = entity;
+	ir_block_start(&b);
+
+	uint64_t index = 0;
+	for (struct param *param = entity->first_param; param; param = param->next) {
+		struct ir_inst *value = ir_emit(&b, ir_op_param, true);
+		value->imm = index++;
+		ir_define_local(&b, param->local, value);
+	}
+
+	ir_build_stmt(&b, entity->body);
+
+	if (!b.block->last || b.block->last->op != ir_op_ret) {
+		ir_emit(&b, ir_op_ret, false);
+	}
+
+	return b.proc;
+}
+
+static struct ir_proc *ir_build(struct entity *first_entity) {
+	struct ir_proc *first = 0;
+	struct ir_proc *last = 0;
+
+	for (struct entity *entity = first_entity; entity; entity = entity->next) {
+		assert(entity->kind == entity_kind_proc);
+		struct ir_proc *proc = ir_build_proc(entity);
+		if (first) {
+			last->next = proc;
+		} else {
+			first = proc;
+		}
+		last = proc;
+	}
+
+	return first;
+}
+
+static void ir_report_inlining(struct entity *proc, struct ir_inline_decision *first_decision, FILE *file) {
+	for (struct ir_inline_decision *decision = first_decision; decision; decision = decision->next) {
+		if (proc->unit->name) fprintf(file, "%s:", proc->unit->name);
+		if (decision->reason) {
+			fprintf(file, "%zu: did not inline %s into %s: %s (size %u)\n", decision->line, decision->callee->name,
+			        proc->name, decision->reason, decision->size);
+		} else {
+			fprintf(file, "%zu: inlined %s into %s (size %u)\n", decision->line, decision->callee->name, proc->name,
+			        decision->size);
+		}
+	}
+}
+
+static void ir_dump_inst(struct ir_inst *inst, FILE *file) {
+	fprintf(file, "\t");
+	if (inst->has_value) fprintf(file, "%%%u = ", inst->id);
+	fprintf(file, "%s", ir_op_strings[inst->op]);
+
+	switch (inst->op) {
+	case ir_op_const:
+	case ir_op_param:
+		fprintf(file, " %llu", (unsigned long long)inst->imm);
+		break;
+
+	case ir_op_local:
+		fprintf(file, " %s", inst->local->name);
+		break;
+
+	case ir_op_proc:
+		fprintf(file, " %s", inst->entity->name);
+		break;
+
+	case ir_op_call:
+		fprintf(file, " %%%u(", inst->a->id);
+		for (size_t i = 0; i < inst->arg_count; i++) {
+			fprintf(file, "%s%%%u", i == 0 ? "" : ", ", inst->args[i]->id);
+		}
+		fprintf(file, ")");
+		break;
+
+	default:
+		if (inst->a) fprintf(file, " %%%u", inst->a->id);
+		if (inst->b) fprintf(file, ", %%%u", inst->b->id);
+		break;
+	}
+
+	fprintf(file, "\n");
+}
+
+static void ir_dump(struct ir_proc *first_proc, FILE *file) {
+	for (struct ir_proc *proc = first_proc; proc; proc = proc->next) {
+		fprintf(file, "proc %s {\n", proc->entity->name);
+		for (struct ir_block *block = proc->first_block; block; block = block->next) {
+			fprintf(file, "b%u:\n", block->id);
+			for (struct ir_inst *inst = block->first; inst; inst = inst->next) {
+				ir_dump_inst(inst, file);
+			}
+		}
+		fprintf(file, "}\n");
+	}
+}
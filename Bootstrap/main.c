@@ -1,11 +1,24 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdalign.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 #define countof(array) (sizeof(array) / sizeof((array)[0]))
 
@@ -17,9 +30,59 @@ static void assert(bool b) {
 	if (!b) unreachable();
 }
 
+static size_t round_up(size_t n, size_t m) {
+	size_t remainder = n % m;
+	if (remainder == 0) return n;
+	size_t result = n + m - remainder;
+	assert(result % m == 0);
+	assert(result > n);
+	return result;
+}
+
+static uint64_t hash_combine(uint64_t hash, uint64_t value) {
+	hash ^= value + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+	return hash * 0xff51afd7ed558ccd;
+}
+
+static uint64_t hash_bytes(const char *s, size_t length) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < length; i++) hash = (hash ^ (uint8_t)s[i]) * 0x100000001b3;
+	return hash;
+}
+
+// A thread that sets a trap catches errors instead of exiting,
+// so errors found in parallel can still be reported in source order
+// and a server can answer a failed request and go on.
+// Errors that are not about a source line have line 0.
+struct error_trap {
+	jmp_buf jump;
+	char *path;
+	size_t line;
+	char *message;
+};
+
+static _Thread_local struct error_trap *error_trap;
+
+// The source file errors are reported against when a compilation has several.
+static _Thread_local char *error_path;
+
 __attribute__((format(printf, 2, 3))) _Noreturn static void error(size_t line, char *fmt, ...) {
 	va_list ap;
+	if (error_trap) {
+		va_start(ap, fmt);
+		int length = vsnprintf(0, 0, fmt, ap);
+		va_end(ap);
+		error_trap->path = error_path;
+		error_trap->line = line;
+		error_trap->message = malloc((size_t)length + 1);
+		va_start(ap, fmt);
+		vsnprintf(error_trap->message, (size_t)length + 1, fmt, ap);
+		va_end(ap);
+		longjmp(error_trap->jump, 1);
+	}
+
 	va_start(ap, fmt);
+	if (error_path) printf("%s:", error_path);
 	printf("%zu: ", line);
 	vprintf(fmt, ap);
 	printf("\n");
@@ -27,29 +90,312 @@ __attribute__((format(printf, 2, 3))) _Noreturn static void error(size_t line, c
 	exit(1);
 }
 
+_Noreturn static void io_error(char *path, char *action) {
+	if (error_trap) {
+		char *reason = strerror(errno);
+		int length = snprintf(0, 0, "cannot %s “%s”: %s", action, path, reason);
+		error_trap->path = 0;
+		error_trap->line = 0;
+		error_trap->message = malloc((size_t)length + 1);
+		snprintf(error_trap->message, (size_t)length + 1, "cannot %s “%s”: %s", action, path, reason);
+		longjmp(error_trap->jump, 1);
+	}
+	fprintf(stderr, "ceramic: cannot %s “%s”: %s\n", action, path, strerror(errno));
+	exit(1);
+}
+
+// Passes an error caught by one trap on to the enclosing trap, or reports it as error and io_error would.
+_Noreturn static void error_raise(struct error_trap *caught) {
+	if (error_trap) {
+		error_trap->path = caught->path;
+		error_trap->line = caught->line;
+		error_trap->message = caught->message;
+		longjmp(error_trap->jump, 1);
+	}
+
+	if (caught->path) {
+		printf("%s:%zu: %s\n", caught->path, caught->line, caught->message);
+	} else if (caught->line) {
+		printf("%zu: %s\n", caught->line, caught->message);
+	} else {
+		fprintf(stderr, "ceramic: %s\n", caught->message);
+	}
+	free(caught->message);
+	exit(1);
+}
+
 #include "ceramic.h"
 #include "arena.c"
+#include "pool.c"
+#include "intern.c"
+#include "source.c"
+#include "emit.c"
+#include "scan.c"
 #include "parser.c"
 #include "type.c"
+#include "ir.c"
+#include "fold.c"
+#include "object.c"
+#include "cache.c"
+#include "unit.c"
 #include "codegen.c"
+#include "a64.c"
+#include "x64.c"
+#include "stats.c"
 
-int main(int argc, char **argv) {
-	if (argc != 2) {
-		fprintf(stderr, "ceramic: usage: ceramic <output path>\n");
+// Runs one compilation given its command-line arguments, without the program name.
+// The source is owned by the caller, so it can be released if an error unwinds out of here.
+static int compile(int argc, char **argv, FILE *diagnostics, struct source *source) {
+	char *output_path = 0;
+	char **source_paths = push_array(char *, (size_t)argc);
+	size_t source_count = 0;
+	bool dump_ir = false;
+	bool report_inlining = false;
+	bool emit_object = false;
+	const char *target_name = default_target_name;
+	size_t worker_count = 0;
+	char *cache_path = 0;
+	bool cache_stats = false;
+	enum stats_format stats_format = stats_format_none;
+
+	for (int i = 0; i < argc; i++) {
+		char *arg = argv[i];
+		if (strcmp(arg, "--dump-ir") == 0) {
+			dump_ir = true;
+		} else if (strcmp(arg, "--inline-report") == 0) {
+			report_inlining = true;
+		} else if (strcmp(arg, "-c") == 0) {
+			emit_object = true;
+		} else if (strcmp(arg, "--target") == 0 && i + 1 < argc) {
+			target_name = argv[++i];
+		} else if (strcmp(arg, "--cache") == 0 && i + 1 < argc) {
+			cache_path = argv[++i];
+		} else if (strcmp(arg, "--cache-stats") == 0) {
+			cache_stats = true;
+		} else if (strcmp(arg, "--stats") == 0) {
+			stats_format = stats_format_text;
+		} else if (strcmp(arg, "--stats=json") == 0) {
+			stats_format = stats_format_json;
+		} else if (strcmp(arg, "-j") == 0 && i + 1 < argc) {
+			char *end = 0;
+			unsigned long count = strtoul(argv[++i], &end, 10);
+			if (count == 0 || *end != 0) {
+				output_path = 0;
+				break;
+			}
+			worker_count = count;
+		} else if (arg[0] != '-' && !output_path) {
+			output_path = arg;
+		} else if (arg[0] != '-') {
+			source_paths[source_count++] = arg;
+		} else {
+			output_path = 0;
+			break;
+		}
+	}
+
+	if (!output_path || (dump_ir && source_count > 1)) {
+		fprintf(diagnostics, "ceramic: usage: ceramic [--target <target>] [-j <workers>] [--cache <directory> [--cache-stats]] [--stats[=json]] [--inline-report] [--dump-ir | -c] <output path> [<source path>]\n");
+		fprintf(diagnostics, "       ceramic [--target <target>] [-j <workers>] [--cache <directory> [--cache-stats]] [--stats[=json]] [--inline-report] [-c] <output directory> <source path> <source path>...\n");
+		fprintf(diagnostics, "       ceramic --serve [<socket path>]\n");
 		return 1;
 	}
-	char *output_path = argv[1];
 
-	char buffer[1024] = {0};
-	size_t n = 0;
+	const struct target *target = target_find(target_name);
+	if (!target) {
+		fprintf(diagnostics, "ceramic: unknown target “%s”; known targets are", target_name);
+		for (size_t i = 0; i < countof(targets); i++) {
+			fprintf(diagnostics, "%s %s", i == 0 ? "" : ",", targets[i].name);
+		}
+		fprintf(diagnostics, "\n");
+		return 1;
+	}
+	if (emit_object && !target->elf) {
+		fprintf(diagnostics, "ceramic: -c needs an ELF target; %s only supports assembly output\n", target->name);
+		return 1;
+	}
 
-	while (n < countof(buffer) - 1) {
-		char c = (char)getchar();
-		if (c == EOF) break;
-		buffer[n++] = c;
+	struct stats stats = {0};
+	stats_start(&stats);
+	pool_init(worker_count);
+	if (cache_path) cache_init(cache_path);
+	inline_report = report_inlining ? diagnostics : 0;
+
+	// Several sources are separate units, each compiled to its own output in the output directory.
+	struct unit *first_unit = 0;
+	if (source_count > 1) {
+		first_unit = units_create(source_paths, source_count, output_path, emit_object, diagnostics);
+		if (!first_unit) return 1;
+	} else {
+		first_unit = push_struct(struct unit);
+		first_unit->source_path = source_count > 0 ? source_paths[0] : 0;
+		first_unit->output_path = output_path;
+	}
+
+	for (struct unit *unit = first_unit; unit; unit = unit->next) {
+		*source = source_read(unit->source_path);
+		stats_end(&stats, "read");
+		error_path = unit->name;
+		if (unit->record_path) unit->source_hash = hash_bytes(source->text, strlen(source->text));
+		unit_load_record(unit, target->name, emit_object);
+		unit->first_node = ast.count;
+		unit->root = parse(source->text);
+		unit->end_node = ast.count;
+		source_release(source);
+		stats_end(&stats, "parse");
+	}
+	struct entity *first_entity = typecheck(first_unit);
+	stats_end(&stats, "typecheck");
+
+	if (dump_ir) {
+		struct ir_proc *first_proc = ir_build(first_entity);
+		for (struct ir_proc *proc = first_proc; inline_report && proc; proc = proc->next) {
+			ir_report_inlining(proc->entity, proc->first_decision, inline_report);
+		}
+		ir_fold(first_proc);
+		stats_end(&stats, "ir");
+		FILE *file = fopen(output_path, "w");
+		if (!file) io_error(output_path, "open");
+		ir_dump(first_proc, file);
+		if (fclose(file) != 0) io_error(output_path, "write");
+	} else {
+		codegen(first_unit, first_entity, target, emit_object);
+		stats_end(&stats, "codegen");
+		for (struct unit *unit = first_unit; unit; unit = unit->next) {
+			if (unit->stale) unit_write(unit, target->name, emit_object);
+		}
+	}
+	stats_end(&stats, "write");
+
+	if (stats_format != stats_format_none) stats_print(&stats, stats_format, first_entity, diagnostics);
+
+	if (cache_stats) {
+		fprintf(diagnostics, "ceramic: cache: %zu hits, %zu misses\n", atomic_load(&cache_hits),
+		        atomic_load(&cache_misses));
+	}
+	return 0;
+}
+
+// Forgets everything a request left behind, keeping the arenas’ first chunks mapped for the next one.
+static void serve_reset(void) {
+	pool_reset();
+	ast_reset();
+	intern_reset();
+	type_reset();
+	cache_reset();
+	counters_reset();
+	inline_report = 0;
+	arena_clear(&scratch_arena);
+	arena_clear(&main_arena);
+}
+
+static int serve_request(int argc, char **argv, FILE *out) {
+	struct source source = {0};
+	struct error_trap trap = {0};
+	int status = 0;
+	if (setjmp(trap.jump)) {
+		if (trap.path) {
+			fprintf(out, "%s:%zu: %s\n", trap.path, trap.line, trap.message);
+		} else if (trap.line) {
+			fprintf(out, "%zu: %s\n", trap.line, trap.message);
+		} else {
+			fprintf(out, "ceramic: %s\n", trap.message);
+		}
+		free(trap.message);
+		status = 1;
+	} else {
+		error_trap = &trap;
+		status = compile(argc, argv, out, &source);
+	}
+	error_trap = 0;
+	error_path = 0;
+	source_release(&source);
+	serve_reset();
+	return status;
+}
+
+// A request is a line holding the arguments of one compilation, separated by spaces or tabs.
+// It is answered with its diagnostics followed by a line “status <exit status>”.
+// Requests read from a stream, so they must give a source path.
+static void serve_session(FILE *in, FILE *out) {
+	char *line = 0;
+	size_t line_capacity = 0;
+	while (getline(&line, &line_capacity, in) > 0) {
+		char *args[64];
+		int arg_count = 0;
+		for (char *arg = strtok(line, " \t\r\n"); arg; arg = strtok(0, " \t\r\n")) {
+			if (arg_count == (int)countof(args)) break;
+			args[arg_count++] = arg;
+		}
+		if (arg_count == 0) continue;
+
+		int path_count = 0;
+		for (int i = 0; i < arg_count; i++) {
+			bool takes_value = strcmp(args[i], "--target") == 0 || strcmp(args[i], "--cache") == 0 ||
+			                   strcmp(args[i], "-j") == 0;
+			if (takes_value) {
+				i++;
+			} else if (args[i][0] != '-') {
+				path_count++;
+			}
+		}
+
+		int status = 1;
+		if (path_count < 2) {
+			fprintf(out, "ceramic: requests must name an output and a source path\n");
+		} else {
+			status = serve_request(arg_count, args, out);
+		}
+		fprintf(out, "status %d\n", status);
+		fflush(out);
+	}
+	free(line);
+}
+
+static void serve_socket(char *path) {
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+		io_error(path, "bind");
+	}
+	strcpy(address.sun_path, path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0) io_error(path, "create");
+	unlink(path);
+	if (bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0) io_error(path, "bind");
+	if (listen(listener, 16) != 0) io_error(path, "listen on");
+
+	// A client hanging up mid-answer must not take the server down.
+	signal(SIGPIPE, SIG_IGN);
+	while (true) {
+		int connection = accept(listener, 0, 0);
+		if (connection < 0) {
+			if (errno == EINTR) continue;
+			io_error(path, "accept on");
+		}
+		FILE *in = fdopen(connection, "r");
+		FILE *out = fdopen(dup(connection), "w");
+		if (!in || !out) io_error(path, "accept on");
+		serve_session(in, out);
+		fclose(in);
+		fclose(out);
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+		if (argc == 2) {
+			serve_session(stdin, stdout);
+		} else if (argc == 3) {
+			serve_socket(argv[2]);
+		} else {
+			fprintf(stderr, "ceramic: usage: ceramic --serve [<socket path>]\n");
+			return 1;
+		}
+		return 0;
 	}
 
-	struct node *root = parse(buffer);
-	struct entity *first_entity = typecheck(root);
-	codegen(first_entity, fopen(output_path, "w"));
+	struct source source = {0};
+	return compile(argc - 1, argv + 1, stderr, &source);
 }
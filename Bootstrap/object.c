@@ -0,0 +1,316 @@
+// Relocatable ELF64 objects. Everything is written in host byte order,
+// which matches the little-endian targets we generate code for.
+
+struct elf_header {
+	uint8_t ident[16];
+	uint16_t type;
+	uint16_t machine;
+	uint32_t version;
+	uint64_t entry;
+	uint64_t program_header_offset;
+	uint64_t section_header_offset;
+	uint32_t flags;
+	uint16_t header_size;
+	uint16_t program_header_size;
+	uint16_t program_header_count;
+	uint16_t section_header_size;
+	uint16_t section_header_count;
+	uint16_t section_names_index;
+};
+
+struct elf_section_header {
+	uint32_t name;
+	uint32_t type;
+	uint64_t flags;
+	uint64_t address;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t link;
+	uint32_t info;
+	uint64_t alignment;
+	uint64_t entry_size;
+};
+
+struct elf_symbol {
+	uint32_t name;
+	uint8_t info;
+	uint8_t other;
+	uint16_t section;
+	uint64_t value;
+	uint64_t size;
+};
+
+struct elf_rela {
+	uint64_t offset;
+	uint64_t info;
+	int64_t addend;
+};
+
+enum {
+	elf_section_text = 1,
+	elf_section_rela_text,
+	elf_section_symtab,
+	elf_section_strtab,
+	elf_section_shstrtab,
+	elf_section_note_gnu_stack,
+	elf_section_count,
+};
+
+static const uint16_t elf_machine_aarch64 = 183;
+static const uint16_t elf_machine_x86_64 = 62;
+
+static const uint32_t elf_reloc_aarch64_adr_prel_pg_hi21 = 275;
+static const uint32_t elf_reloc_aarch64_add_abs_lo12_nc = 277;
+static const uint32_t elf_reloc_aarch64_call26 = 283;
+static const uint32_t elf_reloc_x86_64_pc32 = 2;
+static const uint32_t elf_reloc_x86_64_plt32 = 4;
+
+struct object_symbol {
+	struct object_symbol *next;
+	char *name;
+	bool defined;
+	uint64_t value;
+	uint64_t size;
+	uint32_t index;
+};
+
+struct object_relocation {
+	struct object_relocation *next;
+	uint64_t offset;
+	struct object_symbol *symbol;
+	uint32_t type;
+	int64_t addend;
+};
+
+struct object {
+	uint16_t machine;
+
+	uint8_t *text;
+	size_t text_size;
+	size_t text_capacity;
+
+	struct object_symbol *first_symbol;
+	struct object_symbol *last_symbol;
+	uint32_t symbol_count;
+
+	struct object_relocation *first_relocation;
+	struct object_relocation *last_relocation;
+	size_t relocation_count;
+};
+
+static void object_bytes(struct object *object, const void *bytes, size_t size) {
+	if (object->text_capacity - object->text_size < size) {
+		while (object->text_capacity - object->text_size < size) {
+			object->text_capacity = object->text_capacity == 0 ? 1024 : 2 * object->text_capacity;
+		}
+		object->text = realloc(object->text, object->text_capacity);
+	}
+	memcpy(object->text + object->text_size, bytes, size);
+	object->text_size += size;
+}
+
+static void object_u32(struct object *object, uint32_t value) {
+	object_bytes(object, &value, sizeof(value));
+}
+
+static uint32_t object_read_u32(struct object *object, size_t offset) {
+	uint32_t result = 0;
+	assert(offset + sizeof(result) <= object->text_size);
+	memcpy(&result, object->text + offset, sizeof(result));
+	return result;
+}
+
+static void object_write_u32(struct object *object, size_t offset, uint32_t value) {
+	assert(offset + sizeof(value) <= object->text_size);
+	memcpy(object->text + offset, &value, sizeof(value));
+}
+
+// Symbols start out undefined and become defined once their code is placed,
+// so references may come before definitions.
+static struct object_symbol *object_symbol(struct object *object, char *name) {
+	struct object_symbol *symbol = push_struct(struct object_symbol);
+	symbol->name = name;
+	if (object->first_symbol) {
+		object->last_symbol->next = symbol;
+	} else {
+		object->first_symbol = symbol;
+	}
+	object->last_symbol = symbol;
+	object->symbol_count++;
+	return symbol;
+}
+
+static void object_define(struct object *object, struct object_symbol *symbol) {
+	assert(!symbol->defined);
+	symbol->defined = true;
+	symbol->value = object->text_size;
+}
+
+static void object_relocate(
+        struct object *object, size_t offset, struct object_symbol *symbol, uint32_t type, int64_t addend) {
+	assert(offset < object->text_size);
+	struct object_relocation *relocation = push_struct(struct object_relocation);
+	relocation->offset = offset;
+	relocation->symbol = symbol;
+	relocation->type = type;
+	relocation->addend = addend;
+	if (object->first_relocation) {
+		object->last_relocation->next = relocation;
+	} else {
+		object->first_relocation = relocation;
+	}
+	object->last_relocation = relocation;
+	object->relocation_count++;
+}
+
+static void emit_padding(struct emitter *out, size_t *offset, size_t alignment) {
+	static const char zeros[16] = {0};
+	size_t padding = round_up(*offset, alignment) - *offset;
+	assert(padding <= sizeof(zeros));
+	emit_bytes(out, zeros, padding);
+	*offset += padding;
+}
+
+static void object_write(struct object *object, struct emitter *out) {
+	static const char section_names[] = "\0.text\0.rela.text\0.symtab\0.strtab\0.shstrtab\0.note.GNU-stack";
+	static const uint32_t section_name_offsets[elf_section_count] = {
+	        [elf_section_text] = 1,
+	        [elf_section_rela_text] = 7,
+	        [elf_section_symtab] = 18,
+	        [elf_section_strtab] = 26,
+	        [elf_section_shstrtab] = 34,
+	        [elf_section_note_gnu_stack] = 44,
+	};
+
+	// The null symbol and the section symbol for .text are the only local symbols.
+	uint32_t first_global = 2;
+	size_t symtab_size = sizeof(struct elf_symbol) * (first_global + object->symbol_count);
+	size_t rela_size = sizeof(struct elf_rela) * object->relocation_count;
+
+	size_t strtab_size = 1;
+	uint32_t index = first_global;
+	for (struct object_symbol *symbol = object->first_symbol; symbol; symbol = symbol->next) {
+		symbol->index = index++;
+		strtab_size += strlen(symbol->name) + 1;
+	}
+
+	struct elf_section_header sections[elf_section_count] = {0};
+	size_t offset = sizeof(struct elf_header);
+
+	sections[elf_section_text] = (struct elf_section_header){
+	        .type = 1,
+	        .flags = 0x2 | 0x4,
+	        .offset = offset,
+	        .size = object->text_size,
+	        .alignment = 16,
+	};
+	offset = round_up(offset + object->text_size, 8);
+
+	sections[elf_section_rela_text] = (struct elf_section_header){
+	        .type = 4,
+	        .flags = 0x40,
+	        .offset = offset,
+	        .size = rela_size,
+	        .link = elf_section_symtab,
+	        .info = elf_section_text,
+	        .alignment = 8,
+	        .entry_size = sizeof(struct elf_rela),
+	};
+	offset += rela_size;
+
+	sections[elf_section_symtab] = (struct elf_section_header){
+	        .type = 2,
+	        .offset = offset,
+	        .size = symtab_size,
+	        .link = elf_section_strtab,
+	        .info = first_global,
+	        .alignment = 8,
+	        .entry_size = sizeof(struct elf_symbol),
+	};
+	offset += symtab_size;
+
+	sections[elf_section_strtab] = (struct elf_section_header){
+	        .type = 3,
+	        .offset = offset,
+	        .size = strtab_size,
+	        .alignment = 1,
+	};
+	offset += strtab_size;
+
+	sections[elf_section_shstrtab] = (struct elf_section_header){
+	        .type = 3,
+	        .offset = offset,
+	        .size = sizeof(section_names),
+	        .alignment = 1,
+	};
+	offset += sizeof(section_names);
+
+	sections[elf_section_note_gnu_stack] = (struct elf_section_header){
+	        .type = 1,
+	        .offset = offset,
+	        .alignment = 1,
+	};
+	for (size_t i = 1; i < elf_section_count; i++) sections[i].name = section_name_offsets[i];
+
+	size_t section_header_offset = round_up(offset, 8);
+
+	struct elf_header header = {
+	        .ident = {0x7f, 'E', 'L', 'F', 2, 1, 1},
+	        .type = 1,
+	        .machine = object->machine,
+	        .version = 1,
+	        .section_header_offset = section_header_offset,
+	        .header_size = sizeof(struct elf_header),
+	        .section_header_size = sizeof(struct elf_section_header),
+	        .section_header_count = elf_section_count,
+	        .section_names_index = elf_section_shstrtab,
+	};
+
+	offset = 0;
+	emit_bytes(out, (char *)&header, sizeof(header));
+	offset += sizeof(header);
+	emit_bytes(out, (char *)object->text, object->text_size);
+	offset += object->text_size;
+	emit_padding(out, &offset, 8);
+
+	for (struct object_relocation *relocation = object->first_relocation; relocation;
+	        relocation = relocation->next) {
+		struct elf_rela rela = {
+		        .offset = relocation->offset,
+		        .info = (uint64_t)relocation->symbol->index << 32 | relocation->type,
+		        .addend = relocation->addend,
+		};
+		emit_bytes(out, (char *)&rela, sizeof(rela));
+	}
+
+	struct elf_symbol null_symbol = {0};
+	struct elf_symbol text_symbol = {.info = 3, .section = elf_section_text};
+	emit_bytes(out, (char *)&null_symbol, sizeof(null_symbol));
+	emit_bytes(out, (char *)&text_symbol, sizeof(text_symbol));
+
+	uint32_t name_offset = 1;
+	for (struct object_symbol *symbol = object->first_symbol; symbol; symbol = symbol->next) {
+		struct elf_symbol elf_symbol = {
+		        .name = name_offset,
+		        .info = symbol->defined ? 0x12 : 0x10,
+		        .section = symbol->defined ? elf_section_text : 0,
+		        .value = symbol->value,
+		        .size = symbol->size,
+		};
+		emit_bytes(out, (char *)&elf_symbol, sizeof(elf_symbol));
+		name_offset += (uint32_t)strlen(symbol->name) + 1;
+	}
+
+	emit_char(out, 0);
+	for (struct object_symbol *symbol = object->first_symbol; symbol; symbol = symbol->next) {
+		emit_bytes(out, symbol->name, strlen(symbol->name) + 1);
+	}
+
+	emit_bytes(out, section_names, sizeof(section_names));
+	offset = sections[elf_section_note_gnu_stack].offset;
+	emit_padding(out, &offset, 8);
+	assert(offset == section_header_offset);
+
+	emit_bytes(out, (char *)sections, sizeof(sections));
+	free(object->text);
+}
@@ -49,16 +49,20 @@ static char *const token_kind_strings[] = {
         [token_kind_eof] = "end of file",
 };
 
+// Names are interned; the strings of other tokens point into the source.
 struct token {
 	enum token_kind kind;
 	size_t line;
 	char *string;
+	size_t length;
 };
 
-struct tokens {
-	struct token *ptr;
-	size_t count;
-	size_t capacity;
+// Tokens are produced one at a time as the parser asks for them.
+struct lexer {
+	char *s;
+	size_t line;
+	struct token last_token;
+	const struct scanner *scan;
 };
 
 struct keyword {
@@ -66,287 +70,379 @@ struct keyword {
 	enum token_kind kind;
 };
 
-static const struct keyword keywords[] = {
-        {"proc", token_kind_proc},
-        {"return", token_kind_return},
+// Keywords are found with a perfect hash on their first and last characters;
+// keyword_slot must stay collision-free when keywords are added.
+static const struct keyword keyword_table[4] = {
+        [0] = {"return", token_kind_return},
+        [3] = {"proc", token_kind_proc},
 };
 
-static struct token *tokens_push(struct tokens *tokens) {
-	assert(tokens->count <= tokens->capacity);
-	if (tokens->count == tokens->capacity) {
-		tokens->capacity = tokens->capacity == 0 ? 8 : 2 * tokens->capacity;
-		tokens->ptr = realloc(tokens->ptr, sizeof(struct token) * tokens->capacity);
-	}
-	struct token *token = tokens->ptr + tokens->count;
-	tokens->count++;
-	return token;
+static size_t keyword_slot(const char *s, size_t length) {
+	return ((size_t)(uint8_t)s[0] + (size_t)(uint8_t)s[length - 1]) & (countof(keyword_table) - 1);
 }
 
-static bool is_alpha(char c) {
-	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+static enum token_kind keyword_kind(const char *s, size_t length) {
+	const struct keyword *keyword = keyword_table + keyword_slot(s, length);
+	if (!keyword->string || strncmp(keyword->string, s, length) != 0 || keyword->string[length] != 0) {
+		return token_kind_name;
+	}
+	return keyword->kind;
 }
 
-static bool is_digit(char c) {
-	return c >= '0' && c <= '9';
+static struct lexer lexer_create(char *s) {
+	struct lexer result = {0};
+	result.s = s;
+	result.line = 1;
+	result.last_token.line = 1;
+	result.scan = scanner_select();
+	return result;
 }
 
-static struct tokens lex(char *s) {
-	struct tokens tokens = {0};
-	size_t line = 1;
+static struct token lex(struct lexer *l) {
+	static const uint64_t last_expression_token_kinds = (1 << token_kind_name) | (1 << token_kind_number) |
+	                                                    (1 << token_kind_rparen) | (1 << token_kind_caret);
+
+	while (is_space(*l->s)) {
+		size_t newlines = 0;
+		l->s = l->scan->skip_space(l->s, &newlines);
+		if (newlines == 0) break;
+
+		l->line += newlines;
+		if (last_expression_token_kinds & (1 << l->last_token.kind)) {
+			struct token auto_semi_token = l->last_token;
+			auto_semi_token.kind = token_kind_semi;
+			auto_semi_token.string = ";";
+			auto_semi_token.length = 1;
+			l->last_token = auto_semi_token;
+			counters.tokens++;
+			return auto_semi_token;
+		}
+	}
 
-	while (*s) {
-		if (*s == ' ' || *s == '\t' || *s == '\n') {
-			if (*s == '\n') {
-				if (tokens.count > 0) {
-					struct token last_token = tokens.ptr[tokens.count - 1];
+	struct token token = {0};
+	char *start = l->s;
+	char *s = l->s;
 
-					static const uint64_t last_expression_token_kinds =
-					        (1 << token_kind_name) | (1 << token_kind_number) |
-					        (1 << token_kind_rparen) | (1 << token_kind_caret);
-					if (last_expression_token_kinds & (1 << last_token.kind)) {
-						struct token auto_semi_token = last_token;
-						auto_semi_token.kind = token_kind_semi;
-						auto_semi_token.string = ";";
-						*tokens_push(&tokens) = auto_semi_token;
-					}
-				}
+	if (*s == 0) {
+		token.kind = token_kind_eof;
+		token.line = l->last_token.line;
+		return token;
+	}
 
-				line++;
-			}
+	if (is_alpha(*s) || *s == '_') {
+		token.kind = token_kind_name;
+		s = l->scan->skip_name(s + 1);
+	} else if (is_digit(*s)) {
+		token.kind = token_kind_number;
+		s = l->scan->skip_digits(s + 1);
+	} else {
+		static const enum token_kind single_char_kinds[256] = {
+		        ['+'] = token_kind_plus,
+		        ['-'] = token_kind_hyphen,
+		        ['*'] = token_kind_asterisk,
+		        ['/'] = token_kind_slash,
+		        ['^'] = token_kind_caret,
+		        ['='] = token_kind_equal,
+		        [','] = token_kind_comma,
+		        [':'] = token_kind_colon,
+		        [';'] = token_kind_semi,
+		        ['('] = token_kind_lparen,
+		        [')'] = token_kind_rparen,
+		        ['{'] = token_kind_lbrace,
+		        ['}'] = token_kind_rbrace,
+		};
 
-			s++;
-			continue;
+		token.kind = single_char_kinds[(uint8_t)*s];
+		if (token.kind == 0) {
+			error(l->line, "invalid token “%c”", *s);
 		}
 
-		struct token token = {0};
-		char *start = s;
-
-		if (is_alpha(*s) || *s == '_') {
-			token.kind = token_kind_name;
-			do {
-				s++;
-			} while (is_alpha(*s) || is_digit(*s) || *s == '_');
-		} else if (is_digit(*s)) {
-			token.kind = token_kind_number;
-			do {
-				s++;
-			} while (is_digit(*s));
-		} else {
-			static const enum token_kind single_char_kinds[256] = {
-			        ['+'] = token_kind_plus,
-			        ['-'] = token_kind_hyphen,
-			        ['*'] = token_kind_asterisk,
-			        ['/'] = token_kind_slash,
-			        ['^'] = token_kind_caret,
-			        ['='] = token_kind_equal,
-			        [','] = token_kind_comma,
-			        [':'] = token_kind_colon,
-			        [';'] = token_kind_semi,
-			        ['('] = token_kind_lparen,
-			        [')'] = token_kind_rparen,
-			        ['{'] = token_kind_lbrace,
-			        ['}'] = token_kind_rbrace,
-			};
-
-			token.kind = single_char_kinds[(size_t)*s];
-			if (token.kind == 0) {
-				error(line, "invalid token “%c”", *s);
-			}
+		s++;
+	}
 
-			s++;
-		}
+	token.line = l->line;
+	token.length = (size_t)(s - start);
+	token.string = start;
 
-		size_t len = (size_t)(s - start);
-		char *token_string = push_array(char, len + 1);
-		token.string = memcpy(token_string, start, len);
-		token.line = line;
-
-		if (token.kind == token_kind_name) {
-			for (size_t i = 0; i < countof(keywords); i++) {
-				struct keyword keyword = keywords[i];
-				if (strcmp(token.string, keyword.string) == 0) {
-					token.kind = keyword.kind;
-					break;
-				}
-			}
-		}
+	if (token.kind == token_kind_name) token.kind = keyword_kind(start, token.length);
+	if (token.kind == token_kind_name) token.string = intern(start, token.length);
 
-		*tokens_push(&tokens) = token;
-	}
+	l->s = s;
+	l->last_token = token;
+	counters.tokens++;
+	return token;
+}
+
+enum {
+	ast_field_kinds,
+	ast_field_lines,
+	ast_field_kids,
+	ast_field_data,
+	ast_field_types,
+	ast_field_symbols,
+	ast_field_extra,
+	ast_field_count,
+};
+
+// Each field has an arena of its own, so the arrays grow in place.
+static struct arena ast_arenas[ast_field_count];
+
+static const uint32_t ast_grow_count = 16 * 1024;
+
+static void *ast_grow_field(int field, void *base, size_t element_size, uint32_t old_count, uint32_t new_count) {
+	return arena_grow(ast_arenas + field, base, element_size * old_count, element_size * new_count, 8);
+}
+
+static void ast_grow(void) {
+	uint32_t old = ast.capacity;
+	uint32_t new = old + ast_grow_count;
+	ast.kinds = ast_grow_field(ast_field_kinds, ast.kinds, sizeof(*ast.kinds), old, new);
+	ast.lines = ast_grow_field(ast_field_lines, ast.lines, sizeof(*ast.lines), old, new);
+	ast.kids = ast_grow_field(ast_field_kids, ast.kids, sizeof(*ast.kids), old, new);
+	ast.data = ast_grow_field(ast_field_data, ast.data, sizeof(*ast.data), old, new);
+	ast.types = ast_grow_field(ast_field_types, ast.types, sizeof(*ast.types), old, new);
+	ast.symbols = ast_grow_field(ast_field_symbols, ast.symbols, sizeof(*ast.symbols), old, new);
+	ast.capacity = new;
+
+	// Index 0 is the nil node.
+	if (ast.count == 0) ast.count = 1;
+}
+
+static void ast_reset(void) {
+	for (int i = 0; i < ast_field_count; i++) arena_clear(ast_arenas + i);
+	ast = (struct ast){0};
+}
+
+static bool node_is_nil(uint32_t node) {
+	return node == 0;
+}
 
-	return tokens;
+static enum node_kind node_kind(uint32_t node) {
+	return ast.kinds[node];
 }
 
-static bool node_is_nil(struct node *node) {
-	bool result = node->kind == 0;
+static size_t node_line(uint32_t node) {
+	return ast.lines[node];
+}
+
+static uint32_t node_a(uint32_t node) {
+	return ast.kids[node][0];
+}
+
+static uint32_t node_b(uint32_t node) {
+	return ast.kids[node][1];
+}
+
+static struct node_list node_list(uint32_t node) {
+	struct node_list result = {0};
+	result.nodes = ast.extra + ast.kids[node][0];
+	result.count = ast.kids[node][1];
 	return result;
 }
 
-static struct node *node_create(enum node_kind kind, struct token *token) {
-	struct node *node = push_struct(struct node);
-	node->kind = kind;
-	node->line = token ? token->line : 1;
-	node->next = (struct node *)&node_nil;
-	node->first = (struct node *)&node_nil;
-	node->last = (struct node *)&node_nil;
-	return node;
+static bool node_has_list(enum node_kind kind) {
+	return kind == node_kind_root || kind == node_kind_block || kind == node_kind_params ||
+	       kind == node_kind_call;
 }
 
-static void node_add_kid(struct node *node, struct node *kid) {
-	if (node_is_nil(node->first)) {
-		node->first = kid;
-	} else {
-		node->last->next = kid;
-	}
-	node->last = kid;
+static struct local *node_local(uint32_t node) {
+	struct symbol *symbol = ast.symbols[node];
+	return symbol ? symbol->local : 0;
 }
 
-static struct node *node_find(struct node *node, enum node_kind kind) {
-	struct node *result = (struct node *)&node_nil;
-	for (struct node *kid = node->first; !node_is_nil(kid); kid = kid->next) {
-		if (kid->kind == kind) {
-			result = kid;
-			break;
-		}
+static struct entity *node_entity(uint32_t node) {
+	struct symbol *symbol = ast.symbols[node];
+	return symbol ? symbol->entity : 0;
+}
+
+// Counts the nodes of a subtree, which is how the inliner measures procedures.
+static uint32_t node_size(uint32_t node) {
+	if (node_is_nil(node)) return 0;
+	enum node_kind kind = node_kind(node);
+	uint32_t result = 1;
+	if (node_has_list(kind)) {
+		struct node_list list = node_list(node);
+		for (uint32_t i = 0; i < list.count; i++) result += node_size(list.nodes[i]);
+	} else if (kind != node_kind_name && kind != node_kind_number) {
+		result += node_size(node_a(node)) + node_size(node_b(node));
 	}
 	return result;
 }
 
-static size_t node_kid_count(struct node *node) {
-	size_t count = 0;
-	for (struct node *kid = node->first; !node_is_nil(kid); kid = kid->next) {
-		count++;
-	}
-	return count;
+static uint32_t node_create(enum node_kind kind, struct token token) {
+	if (ast.count == ast.capacity) ast_grow();
+	uint32_t node = ast.count;
+	ast.count++;
+	ast.kinds[node] = (uint8_t)kind;
+	ast.lines[node] = (uint32_t)token.line;
+	return node;
+}
+
+static void node_set_kids(uint32_t node, uint32_t a, uint32_t b) {
+	ast.kids[node][0] = a;
+	ast.kids[node][1] = b;
 }
 
-static void node_print_with_indentation(struct node *node, size_t indentation) {
+static void node_print_with_indentation(uint32_t node, size_t indentation) {
 	for (size_t i = 0; i < indentation; i++) fprintf(stderr, "  ");
 
-	fprintf(stderr, "%s", node_kind_strings[node->kind]);
-	if (node->name) fprintf(stderr, " (%s)", node->name);
-	fprintf(stderr, " (%llu)\n", node->value);
+	enum node_kind kind = node_kind(node);
+	fprintf(stderr, "%s", node_kind_strings[kind]);
+	if (kind == node_kind_number) {
+		fprintf(stderr, " (%llu)\n", (unsigned long long)ast.data[node].value);
+	} else if (ast.data[node].name) {
+		fprintf(stderr, " (%s)\n", ast.data[node].name);
+	} else {
+		fprintf(stderr, "\n");
+	}
 
-	for (struct node *kid = node->first; !node_is_nil(kid); kid = kid->next) {
-		node_print_with_indentation(kid, indentation + 1);
+	if (node_has_list(kind)) {
+		struct node_list list = node_list(node);
+		for (uint32_t i = 0; i < list.count; i++) node_print_with_indentation(list.nodes[i], indentation + 1);
+	} else if (kind != node_kind_name && kind != node_kind_number) {
+		if (!node_is_nil(node_a(node))) node_print_with_indentation(node_a(node), indentation + 1);
+		if (!node_is_nil(node_b(node))) node_print_with_indentation(node_b(node), indentation + 1);
 	}
 }
 
-__attribute__((unused)) static void node_print(struct node *node) {
+__attribute__((unused)) static void node_print(uint32_t node) {
 	node_print_with_indentation(node, 0);
 }
 
 struct parser {
-	struct token *token;
-	size_t remaining_tokens;
-	struct node *root;
+	struct lexer lexer;
+	struct token token;
+	struct token next_token;
+
+	// Elements of the lists being parsed, moved to the extra array as each list ends.
+	uint32_t *stack;
+	uint32_t stack_count;
+	uint32_t stack_capacity;
 };
 
-static uint64_t parse_number(char *s) {
+static uint64_t parse_number(struct token token) {
 	uint64_t result = 0;
-	for (; *s; s++) {
-		if (!is_digit(*s)) break;
+	for (size_t i = 0; i < token.length; i++) {
 		result *= 10;
-		result += (uint64_t)(*s - '0');
+		result += (uint64_t)(token.string[i] - '0');
 	}
 	return result;
 }
 
 static enum token_kind current(struct parser *p) {
-	return p->token->kind;
+	return p->token.kind;
 }
 
 static enum token_kind peek(struct parser *p) {
-	if (p->remaining_tokens == 0) return token_kind_eof;
-	return (p->token + 1)->kind;
+	return p->next_token.kind;
 }
 
 static bool at(struct parser *p, enum token_kind kind) {
 	return current(p) == kind;
 }
 
-static struct token *bump(struct parser *p, enum token_kind kind) {
+static struct token bump(struct parser *p, enum token_kind kind) {
 	assert(at(p, kind));
-	struct token *token = p->token;
-	p->remaining_tokens--;
-	if (p->remaining_tokens == 0) {
-		struct token *eof_token = push_struct(struct token);
-		eof_token->kind = token_kind_eof;
-		eof_token->line = token->line;
-		p->token = eof_token;
-	} else {
-		p->token++;
-	}
+	struct token token = p->token;
+	p->token = p->next_token;
+	if (p->next_token.kind != token_kind_eof) p->next_token = lex(&p->lexer);
 	return token;
 }
 
-static struct token *expect(struct parser *p, enum token_kind kind) {
+static struct token expect(struct parser *p, enum token_kind kind) {
 	assert(kind != token_kind_eof);
 	if (!at(p, kind)) {
-		error(p->token->line, "expected %s, found %s", token_kind_strings[kind],
+		error(p->token.line, "expected %s, found %s", token_kind_strings[kind],
 		        token_kind_strings[current(p)]);
 	}
 	return bump(p, kind);
 }
 
-static struct node *parse_expr(struct parser *p);
+static void list_push(struct parser *p, uint32_t node) {
+	if (p->stack_count == p->stack_capacity) {
+		uint32_t capacity = p->stack_capacity == 0 ? 256 : 2 * p->stack_capacity;
+		p->stack = arena_grow(&scratch_arena, p->stack, sizeof(uint32_t) * p->stack_capacity,
+		        sizeof(uint32_t) * capacity, alignof(uint32_t));
+		p->stack_capacity = capacity;
+	}
+	p->stack[p->stack_count++] = node;
+}
+
+// Gives node the list of everything pushed since the stack held start elements.
+static void list_finish(struct parser *p, uint32_t node, uint32_t start) {
+	uint32_t count = p->stack_count - start;
+	if (ast.extra_count + count > ast.extra_capacity) {
+		uint32_t capacity = ast.extra_capacity + ast_grow_count;
+		if (capacity < ast.extra_count + count) capacity = ast.extra_count + count;
+		ast.extra = ast_grow_field(ast_field_extra, ast.extra, sizeof(*ast.extra), ast.extra_capacity, capacity);
+		ast.extra_capacity = capacity;
+	}
+
+	if (count > 0) memcpy(ast.extra + ast.extra_count, p->stack + start, sizeof(uint32_t) * count);
+	node_set_kids(node, ast.extra_count, count);
+	ast.extra_count += count;
+	p->stack_count = start;
+}
+
+static uint32_t parse_expr(struct parser *p);
 
 static const enum token_kind expr_first = (1 << token_kind_number) | (1 << token_kind_name) |
                                           (1 << token_kind_asterisk) | (1 << token_kind_proc) |
                                           (1 << token_kind_lparen);
 
-static struct node *parse_lhs(struct parser *p) {
-	struct node *result = 0;
+static uint32_t parse_lhs(struct parser *p) {
+	uint32_t result = 0;
 
 	if (((1 << current(p)) & expr_first) == 0) {
-		error(p->token->line, "expected expression");
+		error(p->token.line, "expected expression");
 	}
 
 	switch (current(p)) {
 	case token_kind_number: {
-		struct token *token = bump(p, token_kind_number);
+		struct token token = bump(p, token_kind_number);
 		result = node_create(node_kind_number, token);
-		result->value = parse_number(token->string);
+		ast.data[result].value = parse_number(token);
 		break;
 	}
 
 	case token_kind_name: {
-		struct token *token = bump(p, token_kind_name);
+		struct token token = bump(p, token_kind_name);
 		result = node_create(node_kind_name, token);
-		result->name = token->string;
+		ast.data[result].name = token.string;
 		break;
 	}
 
 	case token_kind_asterisk: {
-		struct token *token = bump(p, token_kind_asterisk);
-		struct node *pointee = parse_lhs(p);
+		struct token token = bump(p, token_kind_asterisk);
+		uint32_t pointee = parse_lhs(p);
 		result = node_create(node_kind_address, token);
-		node_add_kid(result, pointee);
+		node_set_kids(result, pointee, 0);
 		break;
 	}
 
 	case token_kind_proc: {
-		struct token *token = bump(p, token_kind_proc);
+		struct token token = bump(p, token_kind_proc);
 		result = node_create(node_kind_proc_type, token);
 
-		struct token *lparen = expect(p, token_kind_lparen);
-		struct node *params = node_create(node_kind_params, lparen);
-		node_add_kid(result, params);
+		struct token lparen = expect(p, token_kind_lparen);
+		uint32_t params = node_create(node_kind_params, lparen);
+		uint32_t start = p->stack_count;
 		while (!at(p, token_kind_rparen)) {
-			struct node *param = parse_expr(p);
-			node_add_kid(params, param);
+			list_push(p, parse_expr(p));
 			if (!at(p, token_kind_rparen)) expect(p, token_kind_comma);
 		}
+		list_finish(p, params, start);
 		expect(p, token_kind_rparen);
 
+		uint32_t return_type = 0;
 		if ((1 << current(p)) & expr_first) {
-			struct token *t = p->token;
-			struct node *return_type_expr = parse_expr(p);
-			struct node *return_type = node_create(node_kind_type, t);
-			node_add_kid(result, return_type);
-			node_add_kid(return_type, return_type_expr);
+			struct token t = p->token;
+			uint32_t return_type_expr = parse_expr(p);
+			return_type = node_create(node_kind_type, t);
+			node_set_kids(return_type, return_type_expr, 0);
 		}
 
+		node_set_kids(result, params, return_type);
 		break;
 	}
 
@@ -364,23 +460,24 @@ static struct node *parse_lhs(struct parser *p) {
 	while (true) {
 		switch (current(p)) {
 		case token_kind_caret: {
-			struct token *token = bump(p, token_kind_caret);
-			struct node *deref = node_create(node_kind_deref, token);
-			node_add_kid(deref, result);
+			struct token token = bump(p, token_kind_caret);
+			uint32_t deref = node_create(node_kind_deref, token);
+			node_set_kids(deref, result, 0);
 			result = deref;
 			break;
 		}
 
 		case token_kind_lparen: {
-			struct token *lparen = bump(p, token_kind_lparen);
-			struct node *call = node_create(node_kind_call, lparen);
-			node_add_kid(call, result);
+			struct token lparen = bump(p, token_kind_lparen);
+			uint32_t call = node_create(node_kind_call, lparen);
+			uint32_t start = p->stack_count;
+			list_push(p, result);
 			while (!at(p, token_kind_rparen)) {
-				struct node *arg = parse_expr(p);
-				node_add_kid(call, arg);
+				list_push(p, parse_expr(p));
 				if (!at(p, token_kind_rparen)) expect(p, token_kind_comma);
 			}
 			bump(p, token_kind_rparen);
+			list_finish(p, call, start);
 			result = call;
 			break;
 		}
@@ -401,8 +498,8 @@ static bool right_binds_tighter(enum node_kind left, enum node_kind right) {
 	return binding_powers[right] > binding_powers[left];
 }
 
-static struct node *parse_expr_rec(struct parser *p, enum node_kind left_node_kind) {
-	struct node *lhs = parse_lhs(p);
+static uint32_t parse_expr_rec(struct parser *p, enum node_kind left_node_kind) {
+	uint32_t lhs = parse_lhs(p);
 
 	while (true) {
 		static const enum node_kind node_kinds[token_kind__last] = {
@@ -414,43 +511,42 @@ static struct node *parse_expr_rec(struct parser *p, enum node_kind left_node_ki
 
 		enum node_kind right_node_kind = node_kinds[current(p)];
 		if (!right_binds_tighter(left_node_kind, right_node_kind)) break;
-		struct token *operator_token = bump(p, current(p));
-		struct node *rhs = parse_expr_rec(p, right_node_kind);
+		struct token operator_token = bump(p, current(p));
+		uint32_t rhs = parse_expr_rec(p, right_node_kind);
 
-		struct node *new_lhs = node_create(right_node_kind, operator_token);
-		node_add_kid(new_lhs, lhs);
-		node_add_kid(new_lhs, rhs);
+		uint32_t new_lhs = node_create(right_node_kind, operator_token);
+		node_set_kids(new_lhs, lhs, rhs);
 		lhs = new_lhs;
 	}
 
 	return lhs;
 }
 
-static struct node *parse_expr(struct parser *p) {
+static uint32_t parse_expr(struct parser *p) {
 	return parse_expr_rec(p, node_kind_nil);
 }
 
-static struct node *parse_stmt(struct parser *p);
+static uint32_t parse_stmt(struct parser *p);
 
-static struct node *parse_block(struct parser *p) {
-	struct token *lbrace_token = bump(p, token_kind_lbrace);
-	struct node *block = node_create(node_kind_block, lbrace_token);
+static uint32_t parse_block(struct parser *p) {
+	struct token lbrace_token = bump(p, token_kind_lbrace);
+	uint32_t block = node_create(node_kind_block, lbrace_token);
+	uint32_t start = p->stack_count;
 	while (!at(p, token_kind_rbrace)) {
-		struct node *stmt = parse_stmt(p);
-		node_add_kid(block, stmt);
+		list_push(p, parse_stmt(p));
 	}
 	expect(p, token_kind_rbrace);
+	list_finish(p, block, start);
 	return block;
 }
 
-static struct node *parse_stmt(struct parser *p) {
+static uint32_t parse_stmt(struct parser *p) {
 	switch (current(p)) {
 	case token_kind_return: {
-		struct token *token = bump(p, token_kind_return);
-		struct node *stmt = node_create(node_kind_return, token);
+		struct token token = bump(p, token_kind_return);
+		uint32_t stmt = node_create(node_kind_return, token);
 		if (!at(p, token_kind_semi)) {
-			struct node *value = parse_expr(p);
-			node_add_kid(stmt, value);
+			node_set_kids(stmt, parse_expr(p), 0);
 		}
 		expect(p, token_kind_semi);
 		return stmt;
@@ -461,106 +557,108 @@ static struct node *parse_stmt(struct parser *p) {
 
 	default: {
 		if (at(p, token_kind_name) && peek(p) == token_kind_colon) {
-			struct token *name = bump(p, token_kind_name);
-			struct node *local = node_create(node_kind_local, name);
-			local->name = name->string;
+			struct token name = bump(p, token_kind_name);
+			uint32_t local = node_create(node_kind_local, name);
+			ast.data[local].name = name.string;
 
-			struct token *colon = bump(p, token_kind_colon);
+			uint32_t type = 0;
+			uint32_t initializer = 0;
+
+			struct token colon = bump(p, token_kind_colon);
 			if (!at(p, token_kind_equal)) {
-				struct node *type_expr = parse_expr(p);
-				struct node *type = node_create(node_kind_type, colon);
-				node_add_kid(type, type_expr);
-				node_add_kid(local, type);
+				uint32_t type_expr = parse_expr(p);
+				type = node_create(node_kind_type, colon);
+				node_set_kids(type, type_expr, 0);
 			}
 
 			if (!at(p, token_kind_semi)) {
-				struct token *equal = expect(p, token_kind_equal);
-				struct node *initializer_expr = parse_expr(p);
-				struct node *initializer = node_create(node_kind_initializer, equal);
-				node_add_kid(initializer, initializer_expr);
-				node_add_kid(local, initializer);
+				struct token equal = expect(p, token_kind_equal);
+				uint32_t initializer_expr = parse_expr(p);
+				initializer = node_create(node_kind_initializer, equal);
+				node_set_kids(initializer, initializer_expr, 0);
 			}
 
 			expect(p, token_kind_semi);
+			node_set_kids(local, type, initializer);
 			return local;
 		}
 
-		struct node *lhs = parse_expr(p);
+		uint32_t lhs = parse_expr(p);
 		if (at(p, token_kind_equal)) {
-			struct token *equal = expect(p, token_kind_equal);
-			struct node *rhs = parse_expr(p);
+			struct token equal = expect(p, token_kind_equal);
+			uint32_t rhs = parse_expr(p);
 			expect(p, token_kind_semi);
-			struct node *assign = node_create(node_kind_assign, equal);
-			node_add_kid(assign, lhs);
-			node_add_kid(assign, rhs);
+			uint32_t assign = node_create(node_kind_assign, equal);
+			node_set_kids(assign, lhs, rhs);
 			return assign;
 		} else {
-			struct token *semi = expect(p, token_kind_semi);
-			struct node *expr_stmt = node_create(node_kind_expr_stmt, semi);
-			node_add_kid(expr_stmt, lhs);
+			struct token semi = expect(p, token_kind_semi);
+			uint32_t expr_stmt = node_create(node_kind_expr_stmt, semi);
+			node_set_kids(expr_stmt, lhs, 0);
 			return expr_stmt;
 		}
 	}
 	}
 }
 
-static struct node *parse_proc(struct parser *p) {
-	struct token *proc_token = bump(p, token_kind_proc);
-	struct token *name_token = expect(p, token_kind_name);
-	struct node *proc = node_create(node_kind_proc, proc_token);
-	proc->name = name_token->string;
+static uint32_t parse_proc(struct parser *p) {
+	struct token proc_token = bump(p, token_kind_proc);
+	struct token name_token = expect(p, token_kind_name);
+	uint32_t proc = node_create(node_kind_proc, proc_token);
+	ast.data[proc].name = name_token.string;
 
-	struct token *lparen_token = expect(p, token_kind_lparen);
-	struct node *params = node_create(node_kind_params, lparen_token);
-	node_add_kid(proc, params);
+	struct token lparen_token = expect(p, token_kind_lparen);
+	uint32_t signature = node_create(node_kind_proc_type, lparen_token);
+	uint32_t params = node_create(node_kind_params, lparen_token);
+	uint32_t start = p->stack_count;
 
 	while (!at(p, token_kind_rparen)) {
-		struct token *param_name = expect(p, token_kind_name);
-		struct node *param = node_create(node_kind_param, param_name);
-		param->name = param_name->string;
+		struct token param_name = expect(p, token_kind_name);
+		uint32_t param = node_create(node_kind_param, param_name);
+		ast.data[param].name = param_name.string;
 		expect(p, token_kind_colon);
-		struct node *type_expr = parse_expr(p);
-		node_add_kid(param, type_expr);
-		node_add_kid(params, param);
+		node_set_kids(param, parse_expr(p), 0);
+		list_push(p, param);
 
 		if (!at(p, token_kind_rparen)) expect(p, token_kind_comma);
 	}
 
 	bump(p, token_kind_rparen);
+	list_finish(p, params, start);
 
+	uint32_t return_type = 0;
 	if (!at(p, token_kind_lbrace)) {
-		struct token *first_return_type_token = p->token;
-		struct node *return_type_expr = parse_expr(p);
-		struct node *return_type = node_create(node_kind_type, first_return_type_token);
-		node_add_kid(return_type, return_type_expr);
-		node_add_kid(proc, return_type);
+		struct token first_return_type_token = p->token;
+		uint32_t return_type_expr = parse_expr(p);
+		return_type = node_create(node_kind_type, first_return_type_token);
+		node_set_kids(return_type, return_type_expr, 0);
 	}
+	node_set_kids(signature, params, return_type);
 
 	if (!at(p, token_kind_lbrace)) {
-		error(p->token->line, "expected procedure body");
+		error(p->token.line, "expected procedure body");
 	}
-	struct node *block = parse_block(p);
-	node_add_kid(proc, block);
+	node_set_kids(proc, signature, parse_block(p));
 
 	return proc;
 }
 
-static void parse_source_file(struct parser *p) {
-	while (!at(p, token_kind_eof)) {
-		if (!at(p, token_kind_proc)) {
-			error(p->token->line, "expected procedure");
+static uint32_t parse(char *s) {
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+	struct parser p = {0};
+	p.lexer = lexer_create(s);
+	p.token = lex(&p.lexer);
+	p.next_token = p.token.kind == token_kind_eof ? p.token : lex(&p.lexer);
+
+	uint32_t root = node_create(node_kind_root, p.token);
+	while (!at(&p, token_kind_eof)) {
+		if (!at(&p, token_kind_proc)) {
+			error(p.token.line, "expected procedure");
 		}
-		struct node *proc = parse_proc(p);
-		node_add_kid(p->root, proc);
+		list_push(&p, parse_proc(&p));
 	}
-}
+	list_finish(&p, root, 0);
 
-static struct node *parse(char *s) {
-	struct tokens tokens = lex(s);
-	struct parser p = {0};
-	p.token = tokens.ptr;
-	p.remaining_tokens = tokens.count;
-	p.root = node_create(node_kind_root, p.token);
-	parse_source_file(&p);
-	return p.root;
+	arena_reset(&scratch_arena, scratch_mark);
+	return root;
 }
@@ -0,0 +1,89 @@
+// Runs independent jobs, such as checking procedure bodies, on a pool of threads.
+// The calling thread works alongside the others, so with one worker everything runs serially on it.
+// Jobs are claimed in index order, and each thread allocates from an arena of its own
+// so results can outlive the pool without locking main_arena.
+
+static const size_t pool_max_workers = 64;
+
+static size_t pool_worker_count = 1;
+
+// Worker i > 0 allocates from worker_arenas[i]; the calling thread keeps using main_arena.
+static struct arena *worker_arenas;
+
+struct pool {
+	size_t count;
+	atomic_size_t next;
+	void (*run)(void *context, size_t index);
+	void *context;
+};
+
+struct pool_worker {
+	pthread_t thread;
+	struct pool *pool;
+	size_t index;
+};
+
+static void pool_init(size_t worker_count) {
+	if (worker_count == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		worker_count = online > 0 ? (size_t)online : 1;
+	}
+	if (worker_count > pool_max_workers) worker_count = pool_max_workers;
+	pool_worker_count = worker_count;
+	worker_arenas = push_array(struct arena, worker_count);
+}
+
+static void pool_reset(void) {
+	for (size_t i = 0; worker_arenas && i < pool_worker_count; i++) arena_release(worker_arenas + i);
+	worker_arenas = 0;
+	pool_worker_count = 1;
+}
+
+static void pool_run(struct pool *pool) {
+	while (true) {
+		size_t index = atomic_fetch_add(&pool->next, 1);
+		if (index >= pool->count) break;
+		pool->run(pool->context, index);
+	}
+}
+
+static void *pool_worker_main(void *argument) {
+	struct pool_worker *worker = argument;
+	thread_arena = worker_arenas + worker->index;
+	pool_run(worker->pool);
+	arena_release(&scratch_arena);
+	counters_retire();
+	return 0;
+}
+
+// Calls run(context, i) for every i below count and returns once all calls have finished.
+static void pool_for(size_t count, void (*run)(void *context, size_t index), void *context) {
+	struct pool pool = {.count = count, .run = run, .context = context};
+	size_t worker_count = pool_worker_count < count ? pool_worker_count : count;
+
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+	struct pool_worker *workers = arena_push_array(&scratch_arena, struct pool_worker, worker_count);
+	for (size_t i = 1; i < worker_count; i++) {
+		workers[i].pool = &pool;
+		workers[i].index = i;
+		if (pthread_create(&workers[i].thread, 0, pool_worker_main, workers + i) != 0) {
+			fprintf(stderr, "ceramic: cannot create thread\n");
+			exit(1);
+		}
+	}
+
+	// An error must not leave while workers still use the pool, so it waits until they are joined.
+	struct error_trap *outer_trap = error_trap;
+	struct error_trap trap = {0};
+	if (setjmp(trap.jump)) {
+		atomic_store(&pool.next, count);
+	} else {
+		error_trap = &trap;
+		pool_run(&pool);
+	}
+	error_trap = outer_trap;
+
+	for (size_t i = 1; i < worker_count; i++) pthread_join(workers[i].thread, 0);
+	arena_reset(&scratch_arena, scratch_mark);
+	if (trap.message) error_raise(&trap);
+}
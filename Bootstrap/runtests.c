@@ -0,0 +1,215 @@
+// Runs the cases of the tests script in one process, built by ./runtests.
+// The script lists its cases with --list. Each is compiled in-process in order,
+// the way --serve compiles requests, so diagnostics are compared in memory.
+// Only cases that check an exit status are linked and run, in parallel on the worker pool.
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+int ceramic_main(int argc, char **argv);
+#define main ceramic_main
+#include "main.c"
+#undef main
+
+extern char **environ;
+
+#if defined(__linux__)
+static char *const test_output_flag = "-c";
+static char *const test_output_extension = "o";
+#else
+static char *const test_output_flag = 0;
+static char *const test_output_extension = "s";
+#endif
+
+struct test_case {
+	bool expect_error;
+	char *source;
+	char *expected;
+	char *flags;
+
+	char *output_path;
+	char *executable_path;
+	bool compiled;
+	char *actual;
+	bool passed;
+};
+
+struct test_run {
+	struct test_case *cases;
+	size_t case_count;
+	char *directory;
+	char *cc;
+};
+
+static char *test_read_list(size_t *size) {
+	FILE *list = popen("sh ./tests --list", "r");
+	if (!list) io_error("./tests", "run");
+	char *data = 0;
+	size_t capacity = 0;
+	*size = 0;
+	while (true) {
+		if (capacity - *size < 4096) {
+			capacity = capacity == 0 ? 64 * 1024 : 2 * capacity;
+			data = realloc(data, capacity);
+		}
+		size_t n = fread(data + *size, 1, capacity - *size, list);
+		if (n == 0) break;
+		*size += n;
+	}
+	if (pclose(list) != 0) {
+		fprintf(stderr, "runtests: ./tests --list failed\n");
+		exit(1);
+	}
+	return data;
+}
+
+static char *test_field(char **at, char *end) {
+	char *result = *at;
+	char *terminator = memchr(result, 0, (size_t)(end - result));
+	if (!terminator) {
+		fprintf(stderr, "runtests: truncated case list\n");
+		exit(1);
+	}
+	*at = terminator + 1;
+	return result;
+}
+
+static char *test_format(char *fmt, ...) {
+	va_list ap;
+	va_start(ap, fmt);
+	int length = vsnprintf(0, 0, fmt, ap);
+	va_end(ap);
+	char *result = malloc((size_t)length + 1);
+	va_start(ap, fmt);
+	vsnprintf(result, (size_t)length + 1, fmt, ap);
+	va_end(ap);
+	return result;
+}
+
+// Cases in the script share ./fixture-cache; here it becomes a directory of this run’s own.
+static void test_compile(struct test_run *run, struct test_case *test, size_t index) {
+	char *source_path = test_format("%s/case%zu.cer", run->directory, index);
+	FILE *file = fopen(source_path, "w");
+	if (!file) io_error(source_path, "open");
+	fputs(test->source, file);
+	if (fclose(file) != 0) io_error(source_path, "write");
+
+	char *args[32];
+	int arg_count = 0;
+	char *flags = test_format("%s", test->flags);
+	char *cache_path = test_format("%s/cache", run->directory);
+	for (char *flag = strtok(flags, " "); flag && arg_count < 28; flag = strtok(0, " ")) {
+		args[arg_count++] = strcmp(flag, "./fixture-cache") == 0 ? cache_path : flag;
+	}
+	if (test->expect_error) {
+		args[arg_count++] = "/dev/null";
+	} else {
+		test->output_path = test_format("%s/case%zu.%s", run->directory, index, test_output_extension);
+		test->executable_path = test_format("%s/case%zu", run->directory, index);
+		if (test_output_flag) args[arg_count++] = test_output_flag;
+		args[arg_count++] = test->output_path;
+	}
+	args[arg_count++] = source_path;
+
+	char *diagnostics = 0;
+	size_t diagnostics_size = 0;
+	FILE *out = open_memstream(&diagnostics, &diagnostics_size);
+	int status = serve_request(arg_count, args, out);
+	fclose(out);
+
+	// The script compares command substitutions, which drop trailing newlines.
+	while (diagnostics_size > 0 && diagnostics[diagnostics_size - 1] == '\n') diagnostics[--diagnostics_size] = 0;
+	test->actual = diagnostics;
+	test->compiled = status == 0;
+	if (test->expect_error) test->passed = strcmp(test->expected, diagnostics) == 0;
+	free(flags);
+	free(cache_path);
+	unlink(source_path);
+	free(source_path);
+}
+
+// Returns the exit status the way the shell reports it, with 128 added to terminating signals.
+static int test_spawn(char **argv) {
+	pid_t pid = 0;
+	if (posix_spawnp(&pid, argv[0], 0, 0, argv, environ) != 0) return 127;
+	int status = 0;
+	while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) return 127;
+	}
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+static void test_link_and_run(void *context, size_t index) {
+	struct test_run *run = context;
+	struct test_case *test = run->cases + index;
+	if (test->expect_error || !test->compiled) return;
+
+	char *link[] = {run->cc, "-o", test->executable_path, test->output_path, 0};
+	int status = test_spawn(link);
+	if (status != 0) {
+		test->actual = test_format("cannot link, %s exited with %d", run->cc, status);
+		return;
+	}
+	char *execute[] = {test->executable_path, 0};
+	status = test_spawn(execute);
+	free(test->actual);
+	test->actual = test_format("%d", status);
+	test->passed = strcmp(test->expected, test->actual) == 0;
+	unlink(test->output_path);
+	unlink(test->executable_path);
+}
+
+int main(void) {
+	size_t list_size = 0;
+	char *list = test_read_list(&list_size);
+
+	struct test_run run = {0};
+	run.cc = getenv("CC");
+	if (!run.cc) run.cc = "cc";
+	char directory[] = "/tmp/ceramic-tests-XXXXXX";
+	if (!mkdtemp(directory)) io_error(directory, "create");
+	run.directory = directory;
+
+	size_t capacity = 0;
+	for (char *at = list, *end = list + list_size; at < end;) {
+		if (run.case_count == capacity) {
+			capacity = capacity == 0 ? 256 : 2 * capacity;
+			run.cases = realloc(run.cases, capacity * sizeof(struct test_case));
+		}
+		struct test_case *test = run.cases + run.case_count++;
+		*test = (struct test_case){0};
+		test->expect_error = strcmp(test_field(&at, end), "error") == 0;
+		test->source = test_field(&at, end);
+		test->expected = test_field(&at, end);
+		test->flags = test_field(&at, end);
+	}
+
+	for (size_t i = 0; i < run.case_count; i++) test_compile(&run, run.cases + i, i);
+	pool_init(0);
+	pool_for(run.case_count, test_link_and_run, &run);
+
+	size_t failed = 0;
+	for (size_t i = 0; i < run.case_count; i++) {
+		struct test_case *test = run.cases + i;
+		if (test->passed) {
+			printf("PASS: %s\n", test->source);
+		} else if (test->expect_error) {
+			printf("FAIL: %s: expected <%s>, got <%s>\n", test->source, test->expected, test->actual);
+		} else {
+			printf("FAIL: %s: expected %s, got %s\n", test->source, test->expected, test->actual);
+		}
+		failed += !test->passed;
+	}
+	printf("%zu passed, %zu failed\n", run.case_count - failed, failed);
+
+	char *remove[] = {"rm", "-rf", directory, 0};
+	test_spawn(remove);
+	for (size_t i = 0; i < run.case_count; i++) {
+		free(run.cases[i].output_path);
+		free(run.cases[i].executable_path);
+		free(run.cases[i].actual);
+	}
+	free(run.cases);
+	free(list);
+	return failed > 0;
+}
@@ -0,0 +1,198 @@
+// The lexer’s inner loops: skipping whitespace (counting the newlines it contains)
+// and finding the ends of names and numbers.
+// The vector versions may read past the source’s terminating NUL but never fault:
+// they load from the starting position only when the block stays within its page,
+// and otherwise load the aligned block around it and mask off the bytes before it.
+
+struct scanner {
+	char *name;
+	char *(*skip_space)(char *s, size_t *newlines);
+	char *(*skip_name)(char *s);
+	char *(*skip_digits)(char *s);
+};
+
+static bool is_alpha(char c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+static bool is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+static char *scalar_skip_space(char *s, size_t *newlines) {
+	for (; is_space(*s); s++) *newlines += *s == '\n';
+	return s;
+}
+
+static char *scalar_skip_name(char *s) {
+	while (is_alpha(*s) || is_digit(*s) || *s == '_') s++;
+	return s;
+}
+
+static char *scalar_skip_digits(char *s) {
+	while (is_digit(*s)) s++;
+	return s;
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+static const uintptr_t scan_page_size = 4096;
+
+// Returns the block to load to continue scanning at s and sets valid to the bits from s on.
+static char *scan_block(char *s, size_t width, uint32_t *valid) {
+	uint32_t all = width == 32 ? ~0u : (1u << width) - 1;
+	if (((uintptr_t)s & (scan_page_size - 1)) <= scan_page_size - width) {
+		*valid = all;
+		return s;
+	}
+	size_t offset = (uintptr_t)s & (width - 1);
+	*valid = all << offset & all;
+	return s - offset;
+}
+
+static uint32_t sse2_equal(__m128i bytes, char c) {
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+}
+
+// Bytes of 0x80 and above compare as negative, so they are never in range.
+static uint32_t sse2_range(__m128i bytes, char low, char high) {
+	__m128i above = _mm_cmpgt_epi8(bytes, _mm_set1_epi8((char)(low - 1)));
+	__m128i below = _mm_cmplt_epi8(bytes, _mm_set1_epi8((char)(high + 1)));
+	return (uint32_t)_mm_movemask_epi8(_mm_and_si128(above, below));
+}
+
+static uint32_t sse2_name_mask(__m128i bytes) {
+	__m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+	return sse2_range(lower, 'a', 'z') | sse2_range(bytes, '0', '9') | sse2_equal(bytes, '_');
+}
+
+__attribute__((no_sanitize_address)) static char *sse2_skip_space(char *s, size_t *newlines) {
+	if (!is_space(s[1])) {
+		*newlines += *s == '\n';
+		return s + 1;
+	}
+	while (true) {
+		uint32_t valid = 0;
+		char *block = scan_block(s, 16, &valid);
+		__m128i bytes = _mm_loadu_si128((__m128i *)block);
+		uint32_t newline = sse2_equal(bytes, '\n') & valid;
+		uint32_t stop = ~(newline | sse2_equal(bytes, ' ') | sse2_equal(bytes, '\t')) & valid;
+		if (stop) {
+			uint32_t end = (uint32_t)__builtin_ctz(stop);
+			*newlines += (size_t)__builtin_popcount(newline & ((1u << end) - 1));
+			return block + end;
+		}
+		*newlines += (size_t)__builtin_popcount(newline);
+		s = block + 16;
+	}
+}
+
+__attribute__((no_sanitize_address)) static char *sse2_skip_name(char *s) {
+	while (true) {
+		uint32_t valid = 0;
+		char *block = scan_block(s, 16, &valid);
+		uint32_t stop = ~sse2_name_mask(_mm_loadu_si128((__m128i *)block)) & valid;
+		if (stop) return block + __builtin_ctz(stop);
+		s = block + 16;
+	}
+}
+
+__attribute__((no_sanitize_address)) static char *sse2_skip_digits(char *s) {
+	while (true) {
+		uint32_t valid = 0;
+		char *block = scan_block(s, 16, &valid);
+		uint32_t stop = ~sse2_range(_mm_loadu_si128((__m128i *)block), '0', '9') & valid;
+		if (stop) return block + __builtin_ctz(stop);
+		s = block + 16;
+	}
+}
+
+__attribute__((target("avx2"))) static uint32_t avx2_equal(__m256i bytes, char c) {
+	return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c)));
+}
+
+__attribute__((target("avx2"))) static uint32_t avx2_range(__m256i bytes, char low, char high) {
+	__m256i above = _mm256_cmpgt_epi8(bytes, _mm256_set1_epi8((char)(low - 1)));
+	__m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8((char)(high + 1)), bytes);
+	return (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(above, below));
+}
+
+__attribute__((target("avx2"))) static uint32_t avx2_name_mask(__m256i bytes) {
+	__m256i lower = _mm256_or_si256(bytes, _mm256_set1_epi8(0x20));
+	return avx2_range(lower, 'a', 'z') | avx2_range(bytes, '0', '9') | avx2_equal(bytes, '_');
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static char *avx2_skip_space(char *s, size_t *newlines) {
+	if (!is_space(s[1])) {
+		*newlines += *s == '\n';
+		return s + 1;
+	}
+	while (true) {
+		uint32_t valid = 0;
+		char *block = scan_block(s, 32, &valid);
+		__m256i bytes = _mm256_loadu_si256((__m256i *)block);
+		uint32_t newline = avx2_equal(bytes, '\n') & valid;
+		uint32_t stop = ~(newline | avx2_equal(bytes, ' ') | avx2_equal(bytes, '\t')) & valid;
+		if (stop) {
+			uint32_t end = (uint32_t)__builtin_ctz(stop);
+			*newlines += (size_t)__builtin_popcount(newline & ((1u << end) - 1));
+			return block + end;
+		}
+		*newlines += (size_t)__builtin_popcount(newline);
+		s = block + 32;
+	}
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static char *avx2_skip_name(char *s) {
+	while (true) {
+		uint32_t valid = 0;
+		char *block = scan_block(s, 32, &valid);
+		uint32_t stop = ~avx2_name_mask(_mm256_loadu_si256((__m256i *)block)) & valid;
+		if (stop) return block + __builtin_ctz(stop);
+		s = block + 32;
+	}
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) static char *avx2_skip_digits(char *s) {
+	while (true) {
+		uint32_t valid = 0;
+		char *block = scan_block(s, 32, &valid);
+		uint32_t stop = ~avx2_range(_mm256_loadu_si256((__m256i *)block), '0', '9') & valid;
+		if (stop) return block + __builtin_ctz(stop);
+		s = block + 32;
+	}
+}
+#endif
+
+static const struct scanner scanners[] = {
+        {"scalar", scalar_skip_space, scalar_skip_name, scalar_skip_digits},
+#if defined(__x86_64__)
+        {"sse2", sse2_skip_space, sse2_skip_name, sse2_skip_digits},
+        {"avx2", avx2_skip_space, avx2_skip_name, avx2_skip_digits},
+#endif
+};
+
+static bool scanner_supported(const struct scanner *scanner) {
+#if defined(__x86_64__)
+	if (scanner->skip_space == avx2_skip_space) return __builtin_cpu_supports("avx2");
+#endif
+	(void)scanner;
+	return true;
+}
+
+// The widest supported scanner, chosen on first use.
+static const struct scanner *scanner;
+
+static const struct scanner *scanner_select(void) {
+	if (!scanner) {
+		for (size_t i = 0; i < countof(scanners); i++) {
+			if (scanner_supported(scanners + i)) scanner = scanners + i;
+		}
+	}
+	return scanner;
+}
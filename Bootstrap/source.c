@@ -0,0 +1,111 @@
+static const size_t source_read_size = 1024 * 1024;
+
+static size_t page_size(void) {
+	long result = sysconf(_SC_PAGESIZE);
+	assert(result > 0);
+	return (size_t)result;
+}
+
+// Sources are only needed until they are parsed:
+// names are interned and numbers are converted while parsing.
+struct source {
+	char *text;
+	size_t mapping_size;
+	struct arena arena;
+};
+
+// Maps a regular file so that the byte following its contents is NUL.
+// An anonymous zero-filled reservation one byte larger than the file is made first
+// and the file is mapped over its start, so the terminator either falls in
+// the zero tail of the file’s last page or in the anonymous page after it.
+static bool source_map(struct source *source, int fd, size_t size) {
+	size_t mapping_size = size + 1;
+	size_t page = page_size();
+	mapping_size = (mapping_size + page - 1) & ~(page - 1);
+
+	char *text = mmap(0, mapping_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (text == MAP_FAILED) return false;
+
+	if (size > 0) {
+		void *mapped = mmap(text, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+		if (mapped == MAP_FAILED) {
+			munmap(text, mapping_size);
+			return false;
+		}
+		assert(mapped == text);
+	}
+
+	source->text = text;
+	source->mapping_size = mapping_size;
+	return true;
+}
+
+// Reads into the source’s own arena, whose consecutive allocations are contiguous
+// until its reservation runs out, so the text usually grows without being copied.
+static bool source_stream(struct source *source, int fd) {
+	size_t capacity = source_read_size;
+	size_t length = 0;
+	char *text = arena_push_array(&source->arena, char, capacity);
+
+	while (true) {
+		if (capacity - length < source_read_size / 2) {
+			char *more = arena_push_array(&source->arena, char, source_read_size);
+			if (more != text + capacity) {
+				char *grown = arena_push_array(&source->arena, char, 2 * capacity);
+				memcpy(grown, text, length);
+				text = grown;
+				capacity *= 2;
+			} else {
+				capacity += source_read_size;
+			}
+		}
+
+		ssize_t n = read(fd, text + length, capacity - length - 1);
+		if (n == 0) break;
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		length += (size_t)n;
+	}
+
+	text[length] = 0;
+	source->text = text;
+	return true;
+}
+
+// Returns what failed, so a caller that opened fd can close it before reporting the error.
+static char *source_load(struct source *source, int fd) {
+	struct stat st = {0};
+	if (fstat(fd, &st) != 0) return "stat";
+
+	if (S_ISREG(st.st_mode)) {
+		return source_map(source, fd, (size_t)st.st_size) ? 0 : "map";
+	}
+	return source_stream(source, fd) ? 0 : "read";
+}
+
+static struct source source_read(char *path) {
+	struct source result = {0};
+	if (!path) {
+		char *failed = source_load(&result, STDIN_FILENO);
+		if (failed) io_error("<stdin>", failed);
+		return result;
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) io_error(path, "open");
+	char *failed = source_load(&result, fd);
+	int failed_errno = errno;
+	close(fd);
+	errno = failed_errno;
+	if (failed) io_error(path, failed);
+	return result;
+}
+
+static void source_release(struct source *source) {
+	if (source->mapping_size > 0) munmap(source->text, source->mapping_size);
+	arena_release(&source->arena);
+	source->text = 0;
+	source->mapping_size = 0;
+}
@@ -0,0 +1,171 @@
+// Measurements printed by --stats: wall and CPU time per phase, how much each phase allocated,
+// and counts of the work done. CPU time is for the whole process, so it includes pool threads.
+
+enum stats_format {
+	stats_format_none,
+	stats_format_text,
+	stats_format_json,
+};
+
+struct stats_phase {
+	char *name;
+	double wall_seconds;
+	double cpu_seconds;
+	size_t pushed_bytes;
+};
+
+struct stats {
+	struct stats_phase phases[8];
+	size_t phase_count;
+	struct timespec wall_start;
+	struct timespec cpu_start;
+	size_t pushed_start;
+};
+
+// What pool threads counted before they finished.
+static struct {
+	atomic_size_t tokens;
+	atomic_size_t pushed_bytes;
+	atomic_size_t type_lookups;
+	atomic_size_t type_hits;
+	atomic_size_t scope_lookups;
+} retired_counters;
+
+static void counters_retire(void) {
+	atomic_fetch_add(&retired_counters.tokens, counters.tokens);
+	atomic_fetch_add(&retired_counters.pushed_bytes, counters.pushed_bytes);
+	atomic_fetch_add(&retired_counters.type_lookups, counters.type_lookups);
+	atomic_fetch_add(&retired_counters.type_hits, counters.type_hits);
+	atomic_fetch_add(&retired_counters.scope_lookups, counters.scope_lookups);
+	counters = (struct counters){0};
+}
+
+// The calling thread’s counts plus those of every pool thread that has finished.
+static struct counters counters_total(void) {
+	struct counters result = counters;
+	result.tokens += atomic_load(&retired_counters.tokens);
+	result.pushed_bytes += atomic_load(&retired_counters.pushed_bytes);
+	result.type_lookups += atomic_load(&retired_counters.type_lookups);
+	result.type_hits += atomic_load(&retired_counters.type_hits);
+	result.scope_lookups += atomic_load(&retired_counters.scope_lookups);
+	return result;
+}
+
+static void counters_reset(void) {
+	counters = (struct counters){0};
+	atomic_store(&retired_counters.tokens, 0);
+	atomic_store(&retired_counters.pushed_bytes, 0);
+	atomic_store(&retired_counters.type_lookups, 0);
+	atomic_store(&retired_counters.type_hits, 0);
+	atomic_store(&retired_counters.scope_lookups, 0);
+}
+
+static double stats_seconds_between(struct timespec start, struct timespec end) {
+	return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void stats_start(struct stats *stats) {
+	clock_gettime(CLOCK_MONOTONIC, &stats->wall_start);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &stats->cpu_start);
+	stats->pushed_start = counters_total().pushed_bytes;
+}
+
+// Ends the phase begun by the previous stats_start or stats_end and starts the next one.
+// A phase ended more than once, such as parsing each unit, adds up.
+static void stats_end(struct stats *stats, char *name) {
+	struct timespec wall_end = {0};
+	struct timespec cpu_end = {0};
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+	size_t pushed_end = counters_total().pushed_bytes;
+
+	struct stats_phase *phase = 0;
+	for (size_t i = 0; i < stats->phase_count && !phase; i++) {
+		if (strcmp(stats->phases[i].name, name) == 0) phase = stats->phases + i;
+	}
+	if (!phase) {
+		assert(stats->phase_count < countof(stats->phases));
+		phase = stats->phases + stats->phase_count++;
+		phase->name = name;
+	}
+	phase->wall_seconds += stats_seconds_between(stats->wall_start, wall_end);
+	phase->cpu_seconds += stats_seconds_between(stats->cpu_start, cpu_end);
+	phase->pushed_bytes += pushed_end - stats->pushed_start;
+
+	stats->wall_start = wall_end;
+	stats->cpu_start = cpu_end;
+	stats->pushed_start = pushed_end;
+}
+
+static size_t stats_ast_bytes(void) {
+	size_t result = 0;
+	for (int i = 0; i < ast_field_count; i++) result += arena_stats(ast_arenas + i).used;
+	return result;
+}
+
+static void stats_print(struct stats *stats, enum stats_format format, struct entity *first_entity, FILE *file) {
+	struct counters total = counters_total();
+	size_t proc_count = 0;
+	size_t local_count = 0;
+	for (struct entity *entity = first_entity; entity; entity = entity->next) {
+		proc_count++;
+		for (struct local *local = entity->first_local; local; local = local->next) local_count++;
+	}
+	size_t node_count = ast.count > 0 ? ast.count - 1 : 0;
+	double type_hit_rate = total.type_lookups ? (double)total.type_hits / (double)total.type_lookups : 0;
+	// Lasting allocations go to main_arena and to the arenas of pool threads.
+	struct arena_stats arenas = arena_stats(&main_arena);
+	for (size_t i = 1; worker_arenas && i < pool_worker_count; i++) {
+		struct arena_stats worker = arena_stats(worker_arenas + i);
+		arenas.reserved += worker.reserved;
+		arenas.committed += worker.committed;
+		arenas.used += worker.used;
+	}
+
+	double wall_seconds = 0;
+	double cpu_seconds = 0;
+	for (size_t i = 0; i < stats->phase_count; i++) {
+		wall_seconds += stats->phases[i].wall_seconds;
+		cpu_seconds += stats->phases[i].cpu_seconds;
+	}
+
+	if (format == stats_format_json) {
+		fprintf(file, "{\"phases\": [");
+		for (size_t i = 0; i < stats->phase_count; i++) {
+			struct stats_phase *phase = stats->phases + i;
+			fprintf(file, "%s{\"name\": \"%s\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"pushed_bytes\": %zu}",
+			        i == 0 ? "" : ", ", phase->name, phase->wall_seconds, phase->cpu_seconds, phase->pushed_bytes);
+		}
+		fprintf(file, "], \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f", wall_seconds, cpu_seconds);
+		fprintf(file, ", \"tokens\": %zu, \"nodes\": %zu, \"procs\": %zu, \"locals\": %zu", total.tokens, node_count,
+		        proc_count, local_count);
+		fprintf(file, ", \"names\": %zu, \"types\": %zu", intern_table_count, type_count);
+		fprintf(file, ", \"type_lookups\": %zu, \"type_hits\": %zu, \"type_hit_rate\": %.4f", total.type_lookups,
+		        total.type_hits, type_hit_rate);
+		fprintf(file, ", \"scope_lookups\": %zu", total.scope_lookups);
+		fprintf(file, ", \"cache_hits\": %zu, \"cache_misses\": %zu", atomic_load(&cache_hits),
+		        atomic_load(&cache_misses));
+		fprintf(file, ", \"pushed_bytes\": %zu, \"ast_bytes\": %zu", total.pushed_bytes, stats_ast_bytes());
+		fprintf(file, ", \"arenas\": {\"reserved\": %zu, \"committed\": %zu, \"used\": %zu}}\n",
+		        arenas.reserved, arenas.committed, arenas.used);
+		return;
+	}
+
+	fprintf(file, "%-10s %10s %10s %12s\n", "phase", "wall ms", "cpu ms", "pushed KiB");
+	for (size_t i = 0; i < stats->phase_count; i++) {
+		struct stats_phase *phase = stats->phases + i;
+		fprintf(file, "%-10s %10.2f %10.2f %12.1f\n", phase->name, 1e3 * phase->wall_seconds,
+		        1e3 * phase->cpu_seconds, (double)phase->pushed_bytes / 1024);
+	}
+	fprintf(file, "%-10s %10.2f %10.2f %12.1f\n", "total", 1e3 * wall_seconds, 1e3 * cpu_seconds,
+	        (double)total.pushed_bytes / 1024);
+	fprintf(file, "%zu tokens, %zu nodes, %zu procedures, %zu locals, %zu names, %zu types\n", total.tokens,
+	        node_count, proc_count, local_count, intern_table_count, type_count);
+	fprintf(file, "%zu type lookups, %.1f%% found interned; %zu scope lookups\n", total.type_lookups,
+	        100 * type_hit_rate, total.scope_lookups);
+	if (cache_directory) {
+		fprintf(file, "%zu cache hits, %zu cache misses\n", atomic_load(&cache_hits), atomic_load(&cache_misses));
+	}
+	fprintf(file, "arenas: %zu used, %zu committed, %zu reserved; AST: %zu used\n", arenas.used, arenas.committed,
+	        arenas.reserved, stats_ast_bytes());
+}
@@ -7,59 +7,93 @@ static void type_list_push(struct type_node **first, struct type_node **last, st
 	*last = node;
 }
 
-static struct type *interned_types_first;
-static struct type *interned_types_last;
-
-static struct type *type_intern(enum type_kind kind, struct type *inner, struct type_node *first) {
-	struct type *result = 0;
+// Interned types live in an open-addressing table keyed on their structural hash,
+// which is built from the hashes of their component types.
+// Structurally equal types are the same object, so types can be compared by pointer.
+// Procedure bodies are checked in parallel, so the table is guarded by a lock
+// that lookups of existing types only take for reading.
+static pthread_rwlock_t type_table_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct type **type_table;
+static size_t type_table_capacity;
+static size_t type_count;
+
+static uint64_t type_hash(enum type_kind kind, struct type *inner, struct type_node *first) {
+	uint64_t hash = hash_combine(kind, inner ? inner->hash : 0);
+	for (struct type_node *node = first; node; node = node->next) {
+		hash = hash_combine(hash, node->type->hash);
+	}
+	return hash;
+}
 
-	for (struct type *type = interned_types_first; type; type = type->next_interned) {
-		if (type->kind == kind && type->inner == inner) {
-			bool match = true;
+static bool type_matches(struct type *type, enum type_kind kind, struct type *inner, struct type_node *first) {
+	if (type->kind != kind || type->inner != inner) return false;
 
-			struct type_node *n1 = first;
-			struct type_node *n2 = type->first;
+	struct type_node *n1 = first;
+	struct type_node *n2 = type->first;
+	while (n1 && n2) {
+		if (n1->type != n2->type) return false;
+		n1 = n1->next;
+		n2 = n2->next;
+	}
+	return !n1 && !n2;
+}
 
-			while (true) {
-				bool n1_exists = n1;
-				bool n2_exists = n2;
-				if (n1_exists != n2_exists) {
-					match = false;
-					break;
-				}
+static void type_table_insert(struct type *type) {
+	size_t mask = type_table_capacity - 1;
+	size_t i = type->hash & mask;
+	while (type_table[i]) i = (i + 1) & mask;
+	type_table[i] = type;
+}
 
-				if (!n1 || !n2) break;
+static void type_table_grow(void) {
+	struct type **old_table = type_table;
+	size_t old_capacity = type_table_capacity;
 
-				if (n1->type != n2->type) {
-					match = false;
-					break;
-				}
+	type_table_capacity = old_capacity == 0 ? 64 : 2 * old_capacity;
+	type_table = push_array(struct type *, type_table_capacity);
+	for (size_t i = 0; i < old_capacity; i++) {
+		if (old_table[i]) type_table_insert(old_table[i]);
+	}
+}
 
-				n1 = n1->next;
-				n2 = n2->next;
-			}
+static struct type *type_table_find(uint64_t hash, enum type_kind kind, struct type *inner, struct type_node *first) {
+	if (type_table_capacity == 0) return 0;
+	size_t mask = type_table_capacity - 1;
+	for (size_t i = hash & mask; type_table[i]; i = (i + 1) & mask) {
+		struct type *type = type_table[i];
+		if (type->hash == hash && type_matches(type, kind, inner, first)) return type;
+	}
+	return 0;
+}
 
-			if (match) {
-				result = type;
-				break;
-			}
-		}
+static struct type *type_intern(enum type_kind kind, struct type *inner, struct type_node *first) {
+	uint64_t hash = type_hash(kind, inner, first);
+
+	counters.type_lookups++;
+	pthread_rwlock_rdlock(&type_table_lock);
+	struct type *result = type_table_find(hash, kind, inner, first);
+	pthread_rwlock_unlock(&type_table_lock);
+	if (result) {
+		counters.type_hits++;
+		return result;
 	}
 
+	// Another thread may have added the type between the two locks.
+	pthread_rwlock_wrlock(&type_table_lock);
+	result = type_table_find(hash, kind, inner, first);
 	if (!result) {
+		if (4 * (type_count + 1) > 3 * type_table_capacity) type_table_grow();
 		result = push_struct(struct type);
+		result->hash = hash;
 		result->kind = kind;
 		result->inner = inner;
 		result->first = first;
-
-		if (interned_types_first) {
-			interned_types_last->next_interned = result;
-		} else {
-			interned_types_first = result;
-		}
-		interned_types_last = result;
+		type_table_insert(result);
+		type_count++;
+	} else {
+		counters.type_hits++;
 	}
-
+	pthread_rwlock_unlock(&type_table_lock);
 	return result;
 }
 
@@ -75,37 +109,41 @@ static struct type *type_proc(struct type_node *first_param, struct type *return
 	return type_intern(type_kind_proc, return_type, first_param);
 }
 
-static struct type *type_from_expr(struct node *expr) {
-	switch (expr->kind) {
+static char *name_int;
+
+static struct type *type_from_expr(uint32_t expr) {
+	switch (node_kind(expr)) {
 	case node_kind_name:
-		if (strcmp(expr->name, "int") == 0) return type_int();
-		error(expr->line, "unknown type “%s”", expr->name);
+		if (ast.data[expr].name == name_int) return type_int();
+		error(node_line(expr), "unknown type “%s”", ast.data[expr].name);
 
 	case node_kind_address:
-		return type_pointer(type_from_expr(expr->first));
+		return type_pointer(type_from_expr(node_a(expr)));
+
+	// The signature of a procedure declaration lists param nodes instead of bare types.
+	case node_kind_param:
+		return type_from_expr(node_a(expr));
 
 	case node_kind_proc_type: {
-		struct node *params_expr = node_find(expr, node_kind_params);
+		struct node_list params = node_list(node_a(expr));
 
 		struct type_node *first_param = 0;
 		struct type_node *last_param = 0;
 
-		for (struct node *param_expr = params_expr->first; !node_is_nil(param_expr);
-		        param_expr = param_expr->next) {
+		for (uint32_t i = 0; i < params.count; i++) {
 			struct type_node *param = push_struct(struct type_node);
-			param->type = type_from_expr(param_expr);
+			param->type = type_from_expr(params.nodes[i]);
 			type_list_push(&first_param, &last_param, param);
 		}
 
-		struct node *return_type_expr = node_find(expr, node_kind_type)->first;
-		return type_proc(first_param, type_from_expr(return_type_expr));
+		return type_proc(first_param, type_from_expr(node_a(node_b(expr))));
 	}
 
 	case node_kind_nil:
 		return 0;
 
 	default:
-		error(expr->line, "cannot use non-type expression as type");
+		error(node_line(expr), "cannot use non-type expression as type");
 	}
 }
 
@@ -118,7 +156,7 @@ struct buf {
 static struct buf buf_make(void) {
 	struct buf result = {0};
 	result.capacity = 128;
-	result.s = push_array(char, result.capacity);
+	result.s = arena_push_array(&scratch_arena, char, result.capacity);
 	return result;
 }
 
@@ -164,21 +202,34 @@ static void expect_types_equal(struct type *expected, struct type *actual, size_
 	error(line, "expected “%s” but found “%s”", type_print(expected), type_print(actual));
 }
 
-struct symbol {
-	struct symbol *next;
-	struct local *local;
-	struct entity *entity;
-};
-
 struct scope {
 	struct scope *up;
 	struct symbol *first;
 	struct symbol *last;
 };
 
-static struct node *current_root;
+// A name may only be declared once among all enclosing scopes,
+// so every name has at most one visible symbol, which lives in its entry of a scope table.
+// Names are interned and keyed by pointer.
+// Entries are never removed; leaving a scope clears the symbols of its declarations.
+struct scope_entry {
+	char *name;
+	struct symbol *symbol;
+};
+
+struct scope_table {
+	struct scope_entry *entries;
+	size_t capacity;
+	size_t count;
+};
+
 static struct entity *g_first_entity;
-static struct scope *deepest_scope;
+
+// Procedures are declared in the global table before any body is checked, and it is only read afterwards.
+// Every thread checking bodies keeps the locals in scope in a table and scope stack of its own.
+static struct scope_table global_scope_table;
+static _Thread_local struct scope_table local_scope_table;
+static _Thread_local struct scope *deepest_scope;
 
 static char *symbol_name(struct symbol *symbol) {
 	char *result = 0;
@@ -190,36 +241,64 @@ static char *symbol_name(struct symbol *symbol) {
 	return result;
 }
 
+static struct scope_entry *scope_entry_find(struct scope_table *table, char *name) {
+	size_t mask = table->capacity - 1;
+	size_t i = hash_combine(0, (uintptr_t)name) & mask;
+	while (table->entries[i].name && table->entries[i].name != name) i = (i + 1) & mask;
+	return table->entries + i;
+}
+
+static void scope_table_grow(struct scope_table *table) {
+	struct scope_entry *old_entries = table->entries;
+	size_t old_capacity = table->capacity;
+
+	table->capacity = old_capacity == 0 ? 256 : 2 * old_capacity;
+	table->entries = arena_push_array(&scratch_arena, struct scope_entry, table->capacity);
+	for (size_t i = 0; i < old_capacity; i++) {
+		struct scope_entry *entry = old_entries + i;
+		if (entry->name) *scope_entry_find(table, entry->name) = *entry;
+	}
+}
+
 static void scope_push(void) {
-	struct scope *scope = push_struct(struct scope);
+	if (local_scope_table.capacity == 0) scope_table_grow(&local_scope_table);
+	struct scope *scope = arena_push_struct(&scratch_arena, struct scope);
 	scope->up = deepest_scope;
 	deepest_scope = scope;
 }
 
 static void scope_pop(void) {
+	for (struct symbol *symbol = deepest_scope->first; symbol; symbol = symbol->next) {
+		struct scope_entry *entry = scope_entry_find(&local_scope_table, symbol_name(symbol));
+		assert(entry->symbol == symbol);
+		entry->symbol = 0;
+	}
 	deepest_scope = deepest_scope->up;
 }
 
 static struct symbol *scope_find(char *name) {
-	struct symbol *result = 0;
-
-	for (struct scope *scope = deepest_scope; scope; scope = scope->up) {
-		for (struct symbol *symbol = scope->first; symbol; symbol = symbol->next) {
-			if (strcmp(name, symbol_name(symbol)) == 0) {
-				result = symbol;
-				goto done;
-			}
-		}
-	}
-
-done:
-	return result;
+	counters.scope_lookups++;
+	struct symbol *symbol = scope_entry_find(&local_scope_table, name)->symbol;
+	if (!symbol) symbol = scope_entry_find(&global_scope_table, name)->symbol;
+	return symbol;
 }
 
-static void scope_add(struct symbol *symbol, size_t line) {
+static void scope_add(struct scope_table *table, struct symbol *symbol, size_t line) {
+	if (4 * (table->count + 1) > 3 * table->capacity) scope_table_grow(table);
+
 	char *name = symbol_name(symbol);
-	if (scope_find(name)) error(line, "cannot redefine symbol “%s”", name);
+	if (table != &global_scope_table && scope_entry_find(&global_scope_table, name)->symbol) {
+		error(line, "cannot redefine symbol “%s”", name);
+	}
+	struct scope_entry *entry = scope_entry_find(table, name);
+	if (entry->symbol) error(line, "cannot redefine symbol “%s”", name);
+	if (!entry->name) {
+		entry->name = name;
+		table->count++;
+	}
+	entry->symbol = symbol;
 
+	if (table == &global_scope_table) return;
 	if (deepest_scope->first) {
 		deepest_scope->last->next = symbol;
 	} else {
@@ -228,16 +307,18 @@ static void scope_add(struct symbol *symbol, size_t line) {
 	deepest_scope->last = symbol;
 }
 
-static void scope_add_local(struct local *local, size_t line) {
+// Symbols outlive checking because name nodes refer to them.
+static struct symbol *scope_add_local(struct local *local, size_t line) {
 	struct symbol *symbol = push_struct(struct symbol);
 	symbol->local = local;
-	scope_add(symbol, line);
+	scope_add(&local_scope_table, symbol, line);
+	return symbol;
 }
 
 static void scope_add_entity(struct entity *entity, size_t line) {
 	struct symbol *symbol = push_struct(struct symbol);
 	symbol->entity = entity;
-	scope_add(symbol, line);
+	scope_add(&global_scope_table, symbol, line);
 }
 
 static struct local *add_local(struct entity *proc, char *name, struct type *type) {
@@ -246,143 +327,168 @@ static struct local *add_local(struct entity *proc, char *name, struct type *typ
 	local->next = proc->first_local;
 	local->name = name;
 	local->type = type;
-	local->offset = 8;
-	if (proc->first_local) local->offset += proc->first_local->offset;
 	proc->first_local = local;
-	proc->locals_size += 8;
 	return local;
 }
 
-static void check_node(struct entity *proc, struct node *node) {
-	switch (node->kind) {
+static void layout_locals(struct entity *proc) {
+	for (struct local *local = proc->first_local; local; local = local->next) {
+		if (!local->address_taken) continue;
+		proc->locals_size += 8;
+		local->offset = proc->locals_size;
+	}
+}
+
+// Assigning to or taking the address of an expression needs it to live in memory.
+// Building IR relies on this, so that it cannot fail and the earliest error is reported first.
+static void check_addressable(uint32_t node) {
+	switch (node_kind(node)) {
+	case node_kind_name:
+		if (!node_local(node)) error(node_line(node), "cannot take address of procedure");
+		break;
+
+	case node_kind_deref:
+		break;
+
+	default:
+		error(node_line(node), "expression doesn’t have an address");
+	}
+}
+
+static void check_node(struct entity *proc, uint32_t node) {
+	struct type **types = ast.types;
+
+	switch (node_kind(node)) {
 	case node_kind_number:
-		node->type = type_int();
+		types[node] = type_int();
 		break;
 
 	case node_kind_local: {
-		struct node *type_expr = node_find(node, node_kind_type)->first;
-		struct node *initializer = node_find(node, node_kind_initializer);
+		uint32_t type_expr = node_a(node_a(node));
+		uint32_t initializer = node_b(node);
 
 		struct type *type = 0;
 		if (node_is_nil(initializer)) {
 			type = type_from_expr(type_expr);
 		} else {
-			struct node *initializer_expr = initializer->first;
+			uint32_t initializer_expr = node_a(initializer);
 			check_node(proc, initializer_expr);
 
-			if (!initializer_expr->type) {
-				error(initializer_expr->line,
+			if (!types[initializer_expr]) {
+				error(node_line(initializer_expr),
 				        "cannot initialize variable using expression without value");
 			}
 
 			if (node_is_nil(type_expr)) {
-				type = initializer_expr->type;
+				type = types[initializer_expr];
 			} else {
 				type = type_from_expr(type_expr);
-				expect_types_equal(type, initializer_expr->type, initializer->line);
+				expect_types_equal(type, types[initializer_expr], node_line(initializer));
 			}
 		}
 
-		node->local = add_local(proc, node->name, type);
-		scope_add_local(node->local, node->line);
+		struct local *local = add_local(proc, ast.data[node].name, type);
+		ast.symbols[node] = scope_add_local(local, node_line(node));
 		break;
 	}
 
 	case node_kind_name: {
-		struct symbol *symbol = scope_find(node->name);
-		if (!symbol) error(node->line, "unknown name “%s”", node->name);
+		struct symbol *symbol = scope_find(ast.data[node].name);
+		if (!symbol) error(node_line(node), "unknown name “%s”", ast.data[node].name);
 
+		ast.symbols[node] = symbol;
 		if (symbol->local) {
-			node->local = symbol->local;
-			node->type = node->local->type;
+			types[node] = symbol->local->type;
 		} else {
 			assert(symbol->entity->kind == entity_kind_proc);
-			node->entity = symbol->entity;
-			node->type = node->entity->type;
+			types[node] = symbol->entity->type;
 		}
 
 		break;
 	}
 
 	case node_kind_assign: {
-		struct node *lhs = node->first;
-		struct node *rhs = lhs->next;
+		uint32_t lhs = node_a(node);
+		uint32_t rhs = node_b(node);
 		check_node(proc, lhs);
 		check_node(proc, rhs);
-		expect_types_equal(lhs->type, rhs->type, rhs->line);
+		expect_types_equal(types[lhs], types[rhs], node_line(rhs));
+		check_addressable(lhs);
 		break;
 	}
 
 	case node_kind_expr_stmt: {
-		struct node *expr = node->first;
+		uint32_t expr = node_a(node);
 		check_node(proc, expr);
-		if (expr->type) error(expr->line, "unused expression");
+		if (types[expr]) error(node_line(expr), "unused expression");
 		break;
 	}
 
 	case node_kind_return: {
-		struct node *return_value = node->first;
+		uint32_t return_value = node_a(node);
 		if (node_is_nil(return_value)) {
 			if (proc->type->inner) {
-				error(node->line, "missing return value");
+				error(node_line(node), "missing return value");
 			}
 		} else {
 			if (!proc->type->inner) {
-				error(node->line, "cannot return value from procedure with no return value");
+				error(node_line(node), "cannot return value from procedure with no return value");
 			}
 			check_node(proc, return_value);
-			expect_types_equal(proc->type->inner, return_value->type, return_value->line);
+			expect_types_equal(proc->type->inner, types[return_value], node_line(return_value));
 		}
 		break;
 	}
 
 	case node_kind_address: {
-		struct node *operand = node->first;
+		uint32_t operand = node_a(node);
 		check_node(proc, operand);
-		node->type = type_pointer(operand->type);
+		check_addressable(operand);
+		if (node_kind(operand) == node_kind_name) node_local(operand)->address_taken = true;
+		types[node] = type_pointer(types[operand]);
 		break;
 	}
 
 	case node_kind_deref: {
-		struct node *operand = node->first;
+		uint32_t operand = node_a(node);
 		check_node(proc, operand);
-		if (operand->type->kind != type_kind_pointer) {
-			error(node->line, "can’t dereference non-pointer type “%s”", type_print(operand->type));
+		if (types[operand]->kind != type_kind_pointer) {
+			error(node_line(node), "can’t dereference non-pointer type “%s”", type_print(types[operand]));
 		}
-		node->type = operand->type->inner;
+		types[node] = types[operand]->inner;
 		break;
 	}
 
 	case node_kind_call: {
-		struct node *callee = node->first;
+		struct node_list list = node_list(node);
+		uint32_t callee = list.nodes[0];
 		check_node(proc, callee);
+		struct type *callee_type = types[callee];
 
-		if (callee->type->kind != type_kind_proc) {
-			error(node->line, "cannot call value of non-procedure type “%s”", type_print(callee->type));
+		if (callee_type->kind != type_kind_proc) {
+			error(node_line(node), "cannot call value of non-procedure type “%s”", type_print(callee_type));
 		}
 
-		struct node *args = node->first->next;
-		size_t arg_count = node_kid_count(node) - 1;
+		size_t arg_count = list.count - 1;
 
 		size_t param_count = 0;
-		for (struct type_node *param = callee->type->first; param; param = param->next) {
+		for (struct type_node *param = callee_type->first; param; param = param->next) {
 			param_count++;
 		}
 
 		if (arg_count != param_count) {
-			error(node->line, "expected %zu arguments but found %zu", param_count, arg_count);
+			error(node_line(node), "expected %zu arguments but found %zu", param_count, arg_count);
 		}
 
-		struct node *arg = args;
-		struct type_node *param = callee->type->first;
-		while (!node_is_nil(arg) && param) {
+		struct type_node *param = callee_type->first;
+		for (uint32_t i = 1; i < list.count; i++) {
+			uint32_t arg = list.nodes[i];
 			check_node(proc, arg);
-			expect_types_equal(param->type, arg->type, arg->line);
-			arg = arg->next;
+			expect_types_equal(param->type, types[arg], node_line(arg));
 			param = param->next;
 		}
 
-		node->type = callee->type->inner;
+		types[node] = callee_type->inner;
 		break;
 	}
 
@@ -390,23 +496,25 @@ static void check_node(struct entity *proc, struct node *node) {
 	case node_kind_sub:
 	case node_kind_mul:
 	case node_kind_div: {
-		struct node *lhs = node->first;
-		struct node *rhs = lhs->next;
+		uint32_t lhs = node_a(node);
+		uint32_t rhs = node_b(node);
 		check_node(proc, lhs);
 		check_node(proc, rhs);
-		expect_types_equal(type_int(), lhs->type, lhs->line);
-		expect_types_equal(type_int(), rhs->type, rhs->line);
-		node->type = type_int();
+		expect_types_equal(type_int(), types[lhs], node_line(lhs));
+		expect_types_equal(type_int(), types[rhs], node_line(rhs));
+		types[node] = type_int();
 		break;
 	}
 
-	case node_kind_block:
+	case node_kind_block: {
+		struct node_list list = node_list(node);
 		scope_push();
-		for (struct node *kid = node->first; !node_is_nil(kid); kid = kid->next) {
-			check_node(proc, kid);
+		for (uint32_t i = 0; i < list.count; i++) {
+			check_node(proc, list.nodes[i]);
 		}
 		scope_pop();
 		break;
+	}
 
 	case node_kind_nil:
 	case node_kind_root:
@@ -421,82 +529,179 @@ static void check_node(struct entity *proc, struct node *node) {
 	}
 }
 
-static struct entity *typecheck(struct node *root) {
-	current_root = root;
+// Bodies are checked in parallel once every signature is known.
+// Only the error of the earliest failing procedure is reported,
+// so the diagnostic is the same one a serial check would give.
+struct check_pass {
+	struct entity **procs;
+	pthread_mutex_t lock;
+	atomic_size_t first_error;
+	size_t error_line;
+	char *error_message;
+};
+
+static void check_proc(void *context, size_t index) {
+	struct check_pass *pass = context;
+	// Procedures after one that failed cannot change which error is reported.
+	if (index > atomic_load(&pass->first_error)) return;
+
+	struct entity *entity = pass->procs[index];
+	struct error_trap *outer_trap = error_trap;
+	struct error_trap trap = {0};
+	if (setjmp(trap.jump)) {
+		error_trap = outer_trap;
+		// The error unwound out of scopes that were never popped.
+		local_scope_table = (struct scope_table){0};
+		deepest_scope = 0;
+
+		pthread_mutex_lock(&pass->lock);
+		if (index < atomic_load(&pass->first_error)) {
+			free(pass->error_message);
+			pass->error_line = trap.line;
+			pass->error_message = trap.message;
+			atomic_store(&pass->first_error, index);
+		} else {
+			free(trap.message);
+		}
+		pthread_mutex_unlock(&pass->lock);
+		return;
+	}
+
+	error_trap = &trap;
+	scope_push();
+	for (struct param *param = entity->first_param; param; param = param->next) {
+		scope_add_local(param->local, node_line(param->node));
+	}
+	check_node(entity, entity->body);
+	scope_pop();
+	layout_locals(entity);
+	entity->body_size = node_size(entity->body);
+	error_trap = outer_trap;
+}
+
+// Forgets every interned type and entity; their memory goes with the arenas they were allocated from.
+static void type_reset(void) {
+	type_table = 0;
+	type_table_capacity = 0;
+	type_count = 0;
+	g_first_entity = 0;
+	global_scope_table = (struct scope_table){0};
+	local_scope_table = (struct scope_table){0};
+	deepest_scope = 0;
+}
+
+// A fresh unit has to be checked again when a procedure it calls from another unit
+// is gone or has a different signature, though its own source did not change.
+static bool imports_changed(struct unit *unit) {
+	for (struct unit_import *import = unit->first_import; import; import = import->next) {
+		struct symbol *symbol = scope_entry_find(&global_scope_table, import->name)->symbol;
+		if (!symbol || symbol->entity->unit == unit || symbol->entity->type->hash != import->signature) return true;
+	}
+	return false;
+}
+
+// Declares the procedures of every unit, then checks the bodies of stale units against them.
+static struct entity *typecheck(struct unit *first_unit) {
+	name_int = intern_cstring("int");
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
 
 	g_first_entity = 0;
 	struct entity *last_entity = 0;
 
-	for (struct node *node = root->first; !node_is_nil(node); node = node->next) {
-		assert(node->kind == node_kind_proc);
-
-		struct entity *entity = push_struct(struct entity);
-		entity->kind = entity_kind_proc;
-		entity->name = node->name;
-		entity->node = node;
-
-		struct param *first_param = 0;
-		struct param *last_param = 0;
-		struct type_node *first_param_type_node = 0;
-		struct type_node *last_param_type_node = 0;
-
-		struct node *params = node_find(node, node_kind_params);
-		for (struct node *kid = params->first; !node_is_nil(kid); kid = kid->next) {
-			struct param *param = push_struct(struct param);
-			param->name = kid->name;
-			param->node = kid;
-			param->type = type_from_expr(kid->first);
-			param->local = add_local(entity, param->name, param->type);
-
-			if (first_param) {
-				last_param->next = param;
-			} else {
-				first_param = param;
-			}
-			last_param = param;
+	for (struct unit *unit = first_unit; unit; unit = unit->next) {
+		error_path = unit->name;
+		struct node_list procs = node_list(unit->root);
+		for (uint32_t i = 0; i < procs.count; i++) {
+			uint32_t node = procs.nodes[i];
+			assert(node_kind(node) == node_kind_proc);
+			uint32_t signature = node_a(node);
+
+			struct entity *entity = push_struct(struct entity);
+			entity->kind = entity_kind_proc;
+			entity->name = ast.data[node].name;
+			entity->node = node;
+			entity->unit = unit;
+
+			struct param *first_param = 0;
+			struct param *last_param = 0;
+			struct type_node *first_param_type_node = 0;
+			struct type_node *last_param_type_node = 0;
+
+			struct node_list params = node_list(node_a(signature));
+			for (uint32_t j = 0; j < params.count; j++) {
+				uint32_t kid = params.nodes[j];
+				struct param *param = push_struct(struct param);
+				param->name = ast.data[kid].name;
+				param->node = kid;
+				param->type = type_from_expr(node_a(kid));
+				param->local = add_local(entity, param->name, param->type);
+
+				if (first_param) {
+					last_param->next = param;
+				} else {
+					first_param = param;
+				}
+				last_param = param;
 
-			struct type_node *type_node = push_struct(struct type_node);
-			type_node->type = param->type;
-			type_list_push(&first_param_type_node, &last_param_type_node, type_node);
+				struct type_node *type_node = push_struct(struct type_node);
+				type_node->type = param->type;
+				type_list_push(&first_param_type_node, &last_param_type_node, type_node);
 
-			entity->param_count++;
-		}
+				entity->param_count++;
+			}
 
-		entity->first_param = first_param;
+			entity->first_param = first_param;
 
-		struct type *return_type = 0;
-		struct node *return_type_expr = node_find(node, node_kind_type);
-		if (return_type_expr) {
-			return_type = type_from_expr(return_type_expr->first);
-		}
-		entity->type = type_proc(first_param_type_node, return_type);
+			struct type *return_type = type_from_expr(node_a(node_b(signature)));
+			entity->type = type_proc(first_param_type_node, return_type);
 
-		entity->body = node_find(node, node_kind_block);
+			entity->body = node_b(node);
 
-		if (g_first_entity) {
-			last_entity->next = entity;
-		} else {
-			g_first_entity = entity;
+			if (g_first_entity) {
+				last_entity->next = entity;
+			} else {
+				g_first_entity = entity;
+			}
+			last_entity = entity;
 		}
-		last_entity = entity;
 	}
 
-	deepest_scope = 0;
-	scope_push();
+	global_scope_table = (struct scope_table){0};
+	scope_table_grow(&global_scope_table);
+	size_t entity_count = 0;
 	for (struct entity *entity = g_first_entity; entity; entity = entity->next) {
 		assert(entity->kind == entity_kind_proc);
-		scope_add_entity(entity, entity->node->line);
+		error_path = entity->unit->name;
+		scope_add_entity(entity, node_line(entity->node));
+		entity_count++;
+	}
+	for (struct unit *unit = first_unit; unit; unit = unit->next) {
+		if (!unit->stale) unit->stale = imports_changed(unit);
 	}
 
+	struct check_pass pass = {.procs = arena_push_array(&scratch_arena, struct entity *, entity_count)};
+	size_t proc_count = 0;
 	for (struct entity *entity = g_first_entity; entity; entity = entity->next) {
-		assert(entity->kind == entity_kind_proc);
-		scope_push();
-		for (struct param *param = entity->first_param; param; param = param->next) {
-			scope_add_local(param->local, param->node->line);
-		}
-		check_node(entity, entity->body);
-		scope_pop();
+		if (entity->unit->stale) pass.procs[proc_count++] = entity;
 	}
+	pass.first_error = proc_count;
+	pthread_mutex_init(&pass.lock, 0);
+
+	pool_for(proc_count, check_proc, &pass);
+	pthread_mutex_destroy(&pass.lock);
+	if (pass.first_error < proc_count) {
+		size_t size = strlen(pass.error_message) + 1;
+		char *message = memcpy(push_size(size, 1), pass.error_message, size);
+		free(pass.error_message);
+		error_path = pass.procs[pass.first_error]->unit->name;
+		error(pass.error_line, "%s", message);
+	}
+
+	// Scopes and the scope tables are only needed while checking.
+	arena_reset(&scratch_arena, scratch_mark);
+	global_scope_table = (struct scope_table){0};
+	local_scope_table = (struct scope_table){0};
+	deepest_scope = 0;
 
 	return g_first_entity;
 }
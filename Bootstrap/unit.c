@@ -0,0 +1,153 @@
+// A compilation of several sources writes an output per source into a directory,
+// named after the source, next to a record of what the output was compiled from:
+// the source, the output format and the signatures of procedures it calls from other units.
+// A unit whose source is unchanged is only compiled again when one of those signatures changed,
+// so editing a procedure’s body recompiles its own unit and nothing else.
+
+// Bump whenever the record’s layout changes.
+static const uint64_t unit_record_version = 1;
+
+// Longer names in a record mean it is corrupt.
+static const uint64_t unit_name_limit = 1 << 20;
+
+// Units are told apart by their outputs, so two sources must not share a name.
+struct unit_name_table {
+	char **names;
+	size_t capacity;
+};
+
+static char *unit_file_path(char *directory, char *source_path, char *extension) {
+	char *name = strrchr(source_path, '/');
+	name = name ? name + 1 : source_path;
+	char *dot = strrchr(name, '.');
+	int stem_length = dot && dot != name ? (int)(dot - name) : (int)strlen(name);
+
+	size_t size = strlen(directory) + (size_t)stem_length + strlen(extension) + 3;
+	char *result = push_array(char, size);
+	snprintf(result, size, "%s/%.*s.%s", directory, stem_length, name, extension);
+	return result;
+}
+
+// Returns null if two sources would share an output.
+static struct unit *units_create(
+        char **source_paths, size_t count, char *directory, bool emit_object, FILE *diagnostics) {
+	if (mkdir(directory, 0777) != 0 && errno != EEXIST) io_error(directory, "create");
+
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+	struct unit_name_table table = {.capacity = 16};
+	while (table.capacity < 2 * count) table.capacity *= 2;
+	table.names = arena_push_array(&scratch_arena, char *, table.capacity);
+
+	struct unit *first_unit = 0;
+	struct unit *last_unit = 0;
+	for (size_t i = 0; i < count; i++) {
+		struct unit *unit = push_struct(struct unit);
+		unit->source_path = source_paths[i];
+		unit->name = source_paths[i];
+		unit->output_path = unit_file_path(directory, source_paths[i], emit_object ? "o" : "s");
+		unit->record_path = unit_file_path(directory, source_paths[i], "unit");
+
+		size_t mask = table.capacity - 1;
+		size_t j = hash_bytes(unit->output_path, strlen(unit->output_path)) & mask;
+		for (; table.names[j]; j = (j + 1) & mask) {
+			if (strcmp(table.names[j], unit->output_path) == 0) {
+				fprintf(diagnostics, "ceramic: “%s” and another source would both write “%s”\n", unit->source_path,
+				        unit->output_path);
+				arena_reset(&scratch_arena, scratch_mark);
+				return 0;
+			}
+		}
+		table.names[j] = unit->output_path;
+
+		if (first_unit) {
+			last_unit->next = unit;
+		} else {
+			first_unit = unit;
+		}
+		last_unit = unit;
+	}
+
+	arena_reset(&scratch_arena, scratch_mark);
+	return first_unit;
+}
+
+static uint64_t unit_record_key(struct unit *unit, const char *target_name, bool emit_object) {
+	uint64_t hash = hash_combine(unit_record_version, cache_version);
+	hash = hash_combine(hash, hash_bytes(target_name, strlen(target_name)));
+	hash = hash_combine(hash, emit_object);
+	return hash_combine(hash, unit->source_hash);
+}
+
+// Leaves the unit stale unless its output exists and its record matches the source just read,
+// in which case the unit takes the imports its record lists.
+static void unit_load_record(struct unit *unit, const char *target_name, bool emit_object) {
+	unit->stale = true;
+	if (!unit->record_path || access(unit->output_path, F_OK) != 0) return;
+
+	FILE *file = fopen(unit->record_path, "rb");
+	if (!file) return;
+	struct arena_mark scratch_mark = arena_mark(&scratch_arena);
+	uint64_t key = 0;
+	uint64_t import_count = 0;
+	bool valid = fread(&key, sizeof(key), 1, file) == 1 && key == unit_record_key(unit, target_name, emit_object) &&
+	             fread(&import_count, sizeof(import_count), 1, file) == 1;
+
+	struct unit_import *last_import = 0;
+	for (uint64_t i = 0; valid && i < import_count; i++) {
+		uint64_t signature = 0;
+		uint64_t name_length = 0;
+		valid = fread(&signature, sizeof(signature), 1, file) == 1 &&
+		        fread(&name_length, sizeof(name_length), 1, file) == 1 && name_length <= unit_name_limit;
+		if (!valid) break;
+		char *name = arena_push_array(&scratch_arena, char, name_length);
+		valid = fread(name, 1, name_length, file) == name_length;
+		if (!valid) break;
+
+		struct unit_import *import = push_struct(struct unit_import);
+		import->name = intern(name, name_length);
+		import->signature = signature;
+		if (last_import) {
+			last_import->next = import;
+		} else {
+			unit->first_import = import;
+		}
+		last_import = import;
+	}
+	valid = valid && fgetc(file) == EOF;
+	fclose(file);
+	arena_reset(&scratch_arena, scratch_mark);
+
+	unit->stale = !valid;
+	if (!valid) unit->first_import = 0;
+}
+
+// Records the procedures of other units that the unit names.
+static void unit_store_record(struct unit *unit, const char *target_name, bool emit_object) {
+	struct emitter imports = {0};
+	uint64_t import_count = 0;
+	for (uint32_t node = unit->first_node; node < unit->end_node; node++) {
+		struct entity *entity = node_entity(node);
+		if (!entity || entity->unit == unit || entity->last_importer == unit) continue;
+		entity->last_importer = unit;
+
+		uint64_t name_length = strlen(entity->name);
+		emit_bytes(&imports, (char *)&entity->type->hash, sizeof(entity->type->hash));
+		emit_bytes(&imports, (char *)&name_length, sizeof(name_length));
+		emit_bytes(&imports, entity->name, name_length);
+		import_count++;
+	}
+
+	struct emitter record = {0};
+	uint64_t key = unit_record_key(unit, target_name, emit_object);
+	emit_bytes(&record, (char *)&key, sizeof(key));
+	emit_bytes(&record, (char *)&import_count, sizeof(import_count));
+	emit_append(&record, &imports);
+	emit_write(&record, unit->record_path);
+}
+
+// The old record goes first, so a build interrupted while writing the output cannot leave it looking current.
+static void unit_write(struct unit *unit, const char *target_name, bool emit_object) {
+	if (unit->record_path && unlink(unit->record_path) != 0 && errno != ENOENT) io_error(unit->record_path, "remove");
+	emit_write(unit->out, unit->output_path);
+	if (unit->record_path) unit_store_record(unit, target_name, emit_object);
+}
@@ -0,0 +1,477 @@
+// x86-64 System V. Registers are numbered as in the instruction encoding.
+// rax is the return register and is clobbered by idiv, so together with r11 it serves as scratch;
+// rdx, also clobbered by idiv, is never allocated.
+static const uint32_t x64_rax = 0;
+static const uint32_t x64_rdx = 2;
+static const uint32_t x64_rsp = 4;
+static const uint32_t x64_rbp = 5;
+static const uint32_t x64_scratch0 = 0;
+static const uint32_t x64_scratch1 = 11;
+
+// Stands in for a base register to address memory relative to the next instruction.
+static const uint32_t x64_rip = UINT32_MAX - 1;
+
+// Leaf procedures can keep their frame below the stack pointer without moving it.
+static const size_t x64_red_zone_size = 128;
+
+static char *const x64_reg_names[16] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+static char *const x64_reg32_names[16] = {
+        "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+        "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+
+struct x64_opcode {
+	char *mnemonic;
+	uint8_t bytes[2];
+	uint8_t size;
+	uint8_t extension;
+	bool wide;
+};
+
+// Register-register forms take the destination in ModRM.rm except for imul,
+// whose destination goes in ModRM.reg; the assembler makes the same choices.
+static const struct x64_opcode x64_add = {"addq", {0x01}, 1, 0, true};
+static const struct x64_opcode x64_sub = {"subq", {0x29}, 1, 0, true};
+static const struct x64_opcode x64_imul = {"imulq", {0x0f, 0xaf}, 2, 0, true};
+static const struct x64_opcode x64_mov = {"movq", {0x89}, 1, 0, true};
+static const struct x64_opcode x64_load = {"movq", {0x8b}, 1, 0, true};
+static const struct x64_opcode x64_lea = {"leaq", {0x8d}, 1, 0, true};
+static const struct x64_opcode x64_neg = {"negq", {0xf7}, 1, 3, true};
+static const struct x64_opcode x64_idiv = {"idivq", {0xf7}, 1, 7, true};
+static const struct x64_opcode x64_call_indirect = {"call", {0xff}, 1, 2, false};
+
+static void x64_byte(struct codegen *cg, uint8_t byte) {
+	object_bytes(cg->object, &byte, 1);
+}
+
+static void x64_u32(struct codegen *cg, uint32_t value) {
+	object_bytes(cg->object, &value, sizeof(value));
+}
+
+static void x64_rex(struct codegen *cg, bool wide, uint32_t reg, uint32_t rm) {
+	uint8_t rex = (uint8_t)(0x40 | (uint32_t)wide << 3 | (reg & 8) >> 1 | (rm & 8) >> 3);
+	if (rex != 0x40) x64_byte(cg, rex);
+}
+
+static void x64_opcode_bytes(struct codegen *cg, struct x64_opcode op) {
+	for (uint8_t i = 0; i < op.size; i++) x64_byte(cg, op.bytes[i]);
+}
+
+static void x64_encode_rr(struct codegen *cg, struct x64_opcode op, uint32_t reg, uint32_t rm) {
+	x64_rex(cg, op.wide, reg, rm);
+	x64_opcode_bytes(cg, op);
+	x64_byte(cg, (uint8_t)(0xc0 | (reg & 7) << 3 | (rm & 7)));
+}
+
+static void x64_encode_memory(struct codegen *cg, struct x64_opcode op, uint32_t reg, uint32_t base, int64_t disp) {
+	assert(disp >= INT32_MIN && disp <= INT32_MAX);
+	x64_rex(cg, op.wide, reg, base == x64_rip ? 0 : base);
+	x64_opcode_bytes(cg, op);
+
+	if (base == x64_rip) {
+		x64_byte(cg, (uint8_t)((reg & 7) << 3 | 5));
+		x64_u32(cg, (uint32_t)disp);
+		return;
+	}
+
+	// rbp and r13 have no displacement-free form, and rsp and r12 need a SIB byte.
+	uint8_t mod = 2;
+	if (disp == 0 && (base & 7) != 5) {
+		mod = 0;
+	} else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+		mod = 1;
+	}
+	x64_byte(cg, (uint8_t)((uint32_t)mod << 6 | (reg & 7) << 3 | (base & 7)));
+	if ((base & 7) == 4) x64_byte(cg, 0x24);
+	if (mod == 1) x64_byte(cg, (uint8_t)disp);
+	if (mod == 2) x64_u32(cg, (uint32_t)disp);
+}
+
+static void x64_reg(struct codegen *cg, uint32_t reg) {
+	emit_char(cg->out, '%');
+	emit_str(cg->out, x64_reg_names[reg]);
+}
+
+static void x64_reg32(struct codegen *cg, uint32_t reg) {
+	emit_char(cg->out, '%');
+	emit_str(cg->out, x64_reg32_names[reg]);
+}
+
+static void x64_op(struct codegen *cg, char *mnemonic) {
+	emit_char(cg->out, '\t');
+	emit_str(cg->out, mnemonic);
+	emit_char(cg->out, ' ');
+}
+
+static void x64_end(struct codegen *cg) {
+	emit_char(cg->out, '\n');
+}
+
+static void x64_fixed(struct codegen *cg, char *text, const char *bytes, size_t size) {
+	if (cg->object) {
+		object_bytes(cg->object, bytes, size);
+	} else {
+		emit_str(cg->out, text);
+	}
+}
+
+static void x64_memory_operand(struct codegen *cg, uint32_t base, int64_t disp) {
+	if (disp) emit_i64(cg->out, disp);
+	emit_char(cg->out, '(');
+	x64_reg(cg, base);
+	emit_char(cg->out, ')');
+}
+
+// Two-operand instruction with dst in ModRM.rm and src in ModRM.reg.
+static void x64_rr(struct codegen *cg, struct x64_opcode op, uint32_t dst, uint32_t src) {
+	if (cg->object) {
+		x64_encode_rr(cg, op, src, dst);
+		return;
+	}
+	x64_op(cg, op.mnemonic);
+	x64_reg(cg, src);
+	emit_literal(cg->out, ", ");
+	x64_reg(cg, dst);
+	x64_end(cg);
+}
+
+static void x64_multiply(struct codegen *cg, uint32_t dst, uint32_t src) {
+	if (cg->object) {
+		x64_encode_rr(cg, x64_imul, dst, src);
+		return;
+	}
+	x64_op(cg, x64_imul.mnemonic);
+	x64_reg(cg, src);
+	emit_literal(cg->out, ", ");
+	x64_reg(cg, dst);
+	x64_end(cg);
+}
+
+static void x64_unary(struct codegen *cg, struct x64_opcode op, uint32_t reg) {
+	if (cg->object) {
+		x64_encode_rr(cg, op, op.extension, reg);
+		return;
+	}
+	x64_op(cg, op.mnemonic);
+	if (!op.wide) emit_char(cg->out, '*');
+	x64_reg(cg, reg);
+	x64_end(cg);
+}
+
+static void x64_load_store(struct codegen *cg, struct x64_opcode op, uint32_t reg, uint32_t base, int64_t disp) {
+	if (cg->object) {
+		x64_encode_memory(cg, op, reg, base, disp);
+		return;
+	}
+	x64_op(cg, op.mnemonic);
+	if (op.bytes[0] == x64_mov.bytes[0]) {
+		x64_reg(cg, reg);
+		emit_literal(cg->out, ", ");
+		x64_memory_operand(cg, base, disp);
+	} else {
+		x64_memory_operand(cg, base, disp);
+		emit_literal(cg->out, ", ");
+		x64_reg(cg, reg);
+	}
+	x64_end(cg);
+}
+
+static void x64_mov_imm(struct codegen *cg, uint32_t dst, uint64_t value) {
+	if (value == 0) {
+		if (cg->object) {
+			x64_rex(cg, false, dst, dst);
+			x64_byte(cg, 0x31);
+			x64_byte(cg, (uint8_t)(0xc0 | (dst & 7) << 3 | (dst & 7)));
+			return;
+		}
+		x64_op(cg, "xorl");
+		x64_reg32(cg, dst);
+		emit_literal(cg->out, ", ");
+		x64_reg32(cg, dst);
+		x64_end(cg);
+	} else if (value <= UINT32_MAX) {
+		// Writing the 32-bit register zero-extends.
+		if (cg->object) {
+			x64_rex(cg, false, 0, dst);
+			x64_byte(cg, (uint8_t)(0xb8 + (dst & 7)));
+			x64_u32(cg, (uint32_t)value);
+			return;
+		}
+		x64_op(cg, "movl");
+		emit_char(cg->out, '$');
+		emit_u64(cg->out, value);
+		emit_literal(cg->out, ", ");
+		x64_reg32(cg, dst);
+		x64_end(cg);
+	} else if ((int64_t)value < 0 && (int64_t)value >= INT32_MIN) {
+		if (cg->object) {
+			x64_rex(cg, true, 0, dst);
+			x64_byte(cg, 0xc7);
+			x64_byte(cg, (uint8_t)(0xc0 | (dst & 7)));
+			x64_u32(cg, (uint32_t)value);
+			return;
+		}
+		x64_op(cg, "movq");
+		emit_char(cg->out, '$');
+		emit_i64(cg->out, (int64_t)value);
+		emit_literal(cg->out, ", ");
+		x64_reg(cg, dst);
+		x64_end(cg);
+	} else {
+		if (cg->object) {
+			x64_rex(cg, true, 0, dst);
+			x64_byte(cg, (uint8_t)(0xb8 + (dst & 7)));
+			object_bytes(cg->object, &value, sizeof(value));
+			return;
+		}
+		x64_op(cg, "movabsq");
+		emit_char(cg->out, '$');
+		emit_u64(cg->out, value);
+		emit_literal(cg->out, ", ");
+		x64_reg(cg, dst);
+		x64_end(cg);
+	}
+}
+
+static void x64_stack_adjust(struct codegen *cg, size_t size) {
+	assert(size <= INT32_MAX);
+	if (cg->object) {
+		x64_rex(cg, true, 0, x64_rsp);
+		x64_byte(cg, size <= INT8_MAX ? 0x83 : 0x81);
+		x64_byte(cg, 0xc0 | 5 << 3 | 4);
+		if (size <= INT8_MAX) {
+			x64_byte(cg, (uint8_t)size);
+		} else {
+			x64_u32(cg, (uint32_t)size);
+		}
+		return;
+	}
+	emit_literal(cg->out, "\tsubq $");
+	emit_u64(cg->out, size);
+	emit_literal(cg->out, ", %rsp\n");
+}
+
+static void x64_frame_store(struct codegen *cg, uint32_t reg, size_t offset) {
+	x64_load_store(cg, x64_mov, reg, x64_rbp, -(int64_t)offset);
+}
+
+static uint32_t x64_use(struct codegen *cg, uint32_t reg, uint32_t scratch) {
+	if (reg < reg_virtual_first) return reg;
+	struct interval *interval = interval_of(cg, reg);
+	if (interval->reg != reg_none) return interval->reg;
+	x64_load_store(cg, x64_load, scratch, x64_rbp, -(int64_t)interval->spill_offset);
+	return scratch;
+}
+
+static uint32_t x64_def(struct codegen *cg, uint32_t reg) {
+	if (reg < reg_virtual_first) return reg;
+	struct interval *interval = interval_of(cg, reg);
+	if (interval->reg != reg_none) return interval->reg;
+	return x64_scratch0;
+}
+
+static void x64_def_done(struct codegen *cg, uint32_t reg) {
+	if (reg < reg_virtual_first) return;
+	struct interval *interval = interval_of(cg, reg);
+	if (interval->reg == reg_none) x64_frame_store(cg, x64_scratch0, interval->spill_offset);
+}
+
+static void x64_symbol_reference(struct codegen *cg, struct entity *entity, uint32_t type) {
+	// The displacement is relative to the end of the instruction, four bytes past the field.
+	codegen_relocate(cg, entity, type, -4);
+	x64_u32(cg, 0);
+}
+
+static void x64_jump_to_return(struct codegen *cg) {
+	if (cg->object) {
+		x64_byte(cg, 0xe9);
+		struct branch_fixup *fixup = arena_push_struct(&scratch_arena, struct branch_fixup);
+		fixup->offset = cg->object->text_size;
+		fixup->next = cg->return_branches;
+		cg->return_branches = fixup;
+		x64_u32(cg, 0);
+		return;
+	}
+	x64_op(cg, "jmp");
+	codegen_return_label(cg);
+	x64_end(cg);
+}
+
+static void x64_place_return_label(struct codegen *cg) {
+	if (cg->object) {
+		for (struct branch_fixup *fixup = cg->return_branches; fixup; fixup = fixup->next) {
+			uint32_t delta = (uint32_t)(cg->object->text_size - (fixup->offset + 4));
+			object_write_u32(cg->object, fixup->offset, delta);
+		}
+		cg->return_branches = 0;
+		return;
+	}
+	codegen_return_label(cg);
+	emit_literal(cg->out, ":\n");
+}
+
+static void x64_binary(struct codegen *cg, struct inst *inst) {
+	uint32_t lhs = x64_use(cg, inst->src1, x64_scratch0);
+	uint32_t rhs = x64_use(cg, inst->src2, x64_scratch1);
+	uint32_t dst = x64_def(cg, inst->dst);
+	bool commutative = inst->kind != inst_kind_sub;
+
+	if (dst != lhs && dst == rhs && commutative) {
+		rhs = lhs;
+	} else if (dst != lhs && dst == rhs) {
+		// dst = lhs - dst
+		x64_unary(cg, x64_neg, dst);
+		x64_rr(cg, x64_add, dst, lhs);
+		x64_def_done(cg, inst->dst);
+		return;
+	} else if (dst != lhs) {
+		x64_rr(cg, x64_mov, dst, lhs);
+	}
+
+	if (inst->kind == inst_kind_mul) {
+		x64_multiply(cg, dst, rhs);
+	} else {
+		x64_rr(cg, inst->kind == inst_kind_add ? x64_add : x64_sub, dst, rhs);
+	}
+	x64_def_done(cg, inst->dst);
+}
+
+static void x64_inst(struct codegen *cg, struct inst *inst) {
+	switch (inst->kind) {
+	case inst_kind_mov: {
+		uint32_t dst = x64_def(cg, inst->dst);
+		uint32_t src = x64_use(cg, inst->src1, dst);
+		if (dst != src) x64_rr(cg, x64_mov, dst, src);
+		x64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_mov_imm:
+		x64_mov_imm(cg, x64_def(cg, inst->dst), (uint64_t)inst->imm);
+		x64_def_done(cg, inst->dst);
+		break;
+
+	case inst_kind_add:
+	case inst_kind_sub:
+	case inst_kind_mul:
+		x64_binary(cg, inst);
+		break;
+
+	case inst_kind_sdiv: {
+		uint32_t lhs = x64_use(cg, inst->src1, x64_rax);
+		uint32_t rhs = x64_use(cg, inst->src2, x64_scratch1);
+		assert(rhs != x64_rax && rhs != x64_rdx);
+		if (lhs != x64_rax) x64_rr(cg, x64_mov, x64_rax, lhs);
+		x64_fixed(cg, "\tcqto\n", "\x48\x99", 2);
+		x64_unary(cg, x64_idiv, rhs);
+		uint32_t dst = x64_def(cg, inst->dst);
+		if (dst != x64_rax) x64_rr(cg, x64_mov, dst, x64_rax);
+		x64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_frame_address: {
+		uint32_t dst = x64_def(cg, inst->dst);
+		x64_load_store(cg, x64_lea, dst, x64_rbp, -inst->imm);
+		x64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_symbol_address: {
+		uint32_t dst = x64_def(cg, inst->dst);
+		if (cg->object) {
+			x64_rex(cg, true, dst, 0);
+			x64_byte(cg, 0x8d);
+			x64_byte(cg, (uint8_t)((dst & 7) << 3 | 5));
+			x64_symbol_reference(cg, inst->entity, elf_reloc_x86_64_pc32);
+		} else {
+			x64_op(cg, x64_lea.mnemonic);
+			codegen_symbol(cg, inst->entity);
+			emit_literal(cg->out, "(%rip), ");
+			x64_reg(cg, dst);
+			x64_end(cg);
+		}
+		x64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_load: {
+		uint32_t base = x64_use(cg, inst->src1, x64_scratch0);
+		uint32_t dst = x64_def(cg, inst->dst);
+		x64_load_store(cg, x64_load, dst, base, inst->imm);
+		x64_def_done(cg, inst->dst);
+		break;
+	}
+
+	case inst_kind_store: {
+		uint32_t value = x64_use(cg, inst->src1, x64_scratch0);
+		uint32_t base = x64_use(cg, inst->src2, x64_scratch1);
+		x64_load_store(cg, x64_mov, value, base, inst->imm);
+		break;
+	}
+
+	case inst_kind_call:
+		x64_unary(cg, x64_call_indirect, x64_use(cg, inst->src1, x64_scratch1));
+		break;
+
+	case inst_kind_call_direct:
+		if (cg->object) {
+			x64_byte(cg, 0xe8);
+			x64_symbol_reference(cg, inst->entity, elf_reloc_x86_64_plt32);
+		} else {
+			x64_op(cg, "call");
+			codegen_symbol(cg, inst->entity);
+			x64_end(cg);
+		}
+		break;
+
+	case inst_kind_return:
+		if (inst != cg->insts + cg->inst_count - 1) x64_jump_to_return(cg);
+		break;
+	}
+}
+
+static void x64_proc(struct codegen *cg) {
+	bool leaf = true;
+	for (size_t i = 0; i < cg->inst_count; i++) {
+		enum inst_kind kind = cg->insts[i].kind;
+		if (kind == inst_kind_call || kind == inst_kind_call_direct) leaf = false;
+	}
+
+	size_t saved_offset = cg->proc->locals_size + cg->spill_size;
+	size_t saved_size = 8 * (size_t)__builtin_popcount(cg->used_callee_saved);
+	size_t frame_size = round_up(saved_offset + saved_size + round_up(cg->outgoing_size, 16), 16);
+	bool adjust_stack = frame_size > 0 && !(leaf && frame_size <= x64_red_zone_size);
+
+	x64_fixed(cg, "\tpushq %rbp\n", "\x55", 1);
+	x64_fixed(cg, "\tmovq %rsp, %rbp\n", "\x48\x89\xe5", 3);
+	if (adjust_stack) x64_stack_adjust(cg, frame_size);
+
+	size_t offset = saved_offset;
+	for (uint32_t reg = 0; reg < 16; reg++) {
+		if (!(cg->used_callee_saved & (1u << reg))) continue;
+		offset += 8;
+		x64_frame_store(cg, reg, offset);
+	}
+
+	for (size_t i = 0; i < cg->inst_count; i++) {
+		x64_inst(cg, cg->insts + i);
+	}
+
+	x64_place_return_label(cg);
+
+	offset = saved_offset;
+	for (uint32_t reg = 0; reg < 16; reg++) {
+		if (!(cg->used_callee_saved & (1u << reg))) continue;
+		offset += 8;
+		x64_load_store(cg, x64_load, reg, x64_rbp, -(int64_t)offset);
+	}
+
+	if (adjust_stack) x64_fixed(cg, "\tmovq %rbp, %rsp\n", "\x48\x89\xec", 3);
+	x64_fixed(cg, "\tpopq %rbp\n", "\x5d", 1);
+	x64_fixed(cg, "\tretq\n", "\xc3", 1);
+}